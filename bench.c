@@ -0,0 +1,469 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <glob.h>
+#include <err.h>
+
+#include "bench.h"
+#include "cache.h"
+#include "jbod.h"
+#include "l2cache.h"
+#include "mdadm.h"
+#include "net.h"
+#include "stats.h"
+#include "workload.h"
+
+#define BENCH_ARGUMENTS "hbrtlMc:e:w:g:n:z:m:x:s:p:S:o:u:L:T:"
+#define USAGE                                                                     \
+  "USAGE: bench [-h] [-b] [-r] [-t] [-l] [-c num_conns] [-w workload-file]...\n"  \
+  "             [-g pattern]... [-n ops] [-z io_size] [-m write_percent]\n"       \
+  "             [-x repetitions] [-s cache_sizes] [-p policies] [-S seed]\n"      \
+  "             [-e servers] [-u stripe_unit] [-M] [-L l2_size]\n"                \
+  "             [-o results-file] [-T timeout_ms]\n"                              \
+  "\n"                                                                            \
+  "where:\n"                                                                      \
+  "    -h - help mode (display this message)\n"                                   \
+  "    -w - replay a workload file; may be given several times\n"                 \
+  "    -g - replay a generated workload: sequential, random, zipfian or\n"        \
+  "         hotset; may be given several times (without -w or -g, every\n"        \
+  "         trace in traces/ that fits the device and every pattern are\n"        \
+  "         replayed)\n"                                                          \
+  "    -n - requests in a generated workload (default 20000)\n"                   \
+  "    -z - bytes per generated request (default 256)\n"                          \
+  "    -m - percentage of generated requests that are writes (default 30)\n"      \
+  "    -S - seed of the generated workloads (default 1)\n"                        \
+  "    -x - times each configuration is replayed (default 3)\n"                   \
+  "    -s - comma separated cache sizes to sweep, 0 for no cache (default\n"      \
+  "         0,1024)\n"                                                            \
+  "    -p - comma separated cache policies to sweep (default lru)\n"              \
+  "    -b - write-back cache\n"                                                   \
+  "    -L - blocks of a second cache level in l2cache.img\n"                      \
+  "    -r - sequential read-ahead into the cache\n"                               \
+  "    -t - one I/O worker and server connection per disk\n"                      \
+  "    -c - number of server connections the disks are spread over\n"             \
+  "    -e - comma separated ip:port list of the JBOD servers whose disks\n"       \
+  "         make up the device (default 127.0.0.1:3333)\n"                        \
+  "    -T - milliseconds a server may take to answer the probe sent over each\n"  \
+  "         new connection; 0 skips the probe (default 2000)\n"                   \
+  "    -u - stripe the device over the disks in units of stripe_unit bytes\n"     \
+  "         (default: linear)\n"                                                  \
+  "    -M - mirror the first half of the disks onto the second half\n"            \
+  "    -l - run JBOD in this process instead of talking to the server\n"          \
+  "    -o - append one JSON object per replay to results-file instead of\n"       \
+  "         writing them to stdout\n"                                             \
+  "\n"                                                                            \
+
+#define MAX_WORKLOADS 64
+#define MAX_CACHE_SIZES 16
+
+typedef struct {
+  const char *name;   /* the file, or the pattern it was generated from */
+  char path[64];      /* the file replayed */
+  bool generated;     /* whether the file is ours to remove */
+} workload_t;
+
+static const char *pattern_names[BENCH_NUM_PATTERNS] = {"sequential", "random", "zipfian", "hotset"};
+static const char *layout_names[MDADM_NUM_LAYOUTS] = {"linear", "striped", "mirrored"};
+
+static uint64_t rand_state;
+
+// xorshift64*, so that a seed always generates the same workload
+static uint64_t next_rand(void) {
+  rand_state ^= rand_state >> 12;
+  rand_state ^= rand_state << 25;
+  rand_state ^= rand_state >> 27;
+  return rand_state * 2685821657736338717ULL;
+}
+
+// a uniformly random integer in [0, n)
+static uint32_t rand_below(uint32_t n) {
+  return (uint32_t)((next_rand() >> 32) * n >> 32);
+}
+
+// a uniformly random double in [0, 1)
+static double rand_unit(void) {
+  return (next_rand() >> 11) * (1.0 / (1ULL << 53));
+}
+
+// the cumulative distribution of a zipfian choice among n requests
+static double *zipf_cdf(uint32_t n) {
+  double *cdf = malloc(n * sizeof(double)), sum = 0;
+  if (!cdf)
+    err(1, "Cannot allocate the zipfian distribution");
+
+  for (uint32_t k = 0; k < n; ++k) {
+    sum += 1 / pow(k + 1, BENCH_ZIPF_THETA);
+    cdf[k] = sum;
+  }
+  for (uint32_t k = 0; k < n; ++k)
+    cdf[k] /= sum;
+  return cdf;
+}
+
+// the first request whose cumulative probability reaches u
+static uint32_t zipf_pick(const double *cdf, uint32_t n, double u) {
+  uint32_t low = 0, high = n - 1;
+
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    if (cdf[mid] < u)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+// writes a workload of |ops| requests of |io_size| bytes following |pattern| over the first |space| bytes of the
+// device to a temporary file
+static void generate(workload_t *w, bench_pattern_t pattern, int ops, uint32_t io_size, int write_percent, uint32_t space) {
+  uint32_t slots = space / io_size;
+  uint32_t hot_slots = slots * BENCH_HOT_SET_PERCENT / 100 + 1;
+  uint32_t hot_start = rand_below(slots - hot_slots + 1);
+  double *cdf = pattern == BENCH_ZIPFIAN ? zipf_cdf(slots) : NULL;
+
+  strcpy(w->path, "/tmp/bench-XXXXXX");
+  int fd = mkstemp(w->path);
+  FILE *f = fd == -1 ? NULL : fdopen(fd, "w");
+  if (!f)
+    err(1, "Cannot create a workload file");
+  w->name = pattern_names[pattern];
+  w->generated = true;
+
+  fprintf(f, "MOUNT\n");
+  for (int i = 0; i < ops; ++i) {
+    uint32_t slot;
+
+    switch (pattern) {
+      case BENCH_SEQUENTIAL:
+        slot = i % slots;
+        break;
+      case BENCH_ZIPFIAN:
+        // scatter the popular requests over the disks rather than packing them at the start
+        slot = (uint32_t)((uint64_t)zipf_pick(cdf, slots, rand_unit()) * 2654435761u % slots);
+        break;
+      case BENCH_HOTSET:
+        if (rand_below(100) < BENCH_HOT_ACCESS_PERCENT) {
+          slot = hot_start + rand_below(hot_slots);
+          break;
+        }
+        // fall through
+      default:
+        slot = rand_below(slots);
+        break;
+    }
+    if ((int)rand_below(100) < write_percent)
+      fprintf(f, "WRITE %u %u %u\n", slot * io_size, io_size, rand_below(256));
+    else
+      fprintf(f, "READ %u %u 0\n", slot * io_size, io_size);
+  }
+  fprintf(f, "UNMOUNT\n");
+
+  if (fclose(f) == EOF)
+    err(1, "Cannot write workload file %s", w->path);
+  free(cdf);
+}
+
+// whether every request of the trace at |path| lies within the first |space| bytes of the device
+static bool fits(const char *path, uint32_t space) {
+  char line[256];
+  uint32_t addr, len, ch;
+  int used;
+  bool ok = true;
+
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+  while (ok && fgets(line, sizeof(line), f)) {
+    bool write = strncmp(line, "WRITEV ", 7) == 0;
+    if (write || strncmp(line, "READV ", 6) == 0) {
+      char *p = line + (write ? 6 : 5);
+      while (ok && (write ? sscanf(p, "%u %u %u%n", &addr, &len, &ch, &used) == 3
+                          : sscanf(p, "%u %u%n", &addr, &len, &used) == 2)) {
+        ok = addr <= space && len <= space - addr;
+        p += used;
+      }
+    } else if (sscanf(line, "%*s %u %u", &addr, &len) == 2) {
+      ok = addr <= space && len <= space - addr;
+    }
+  }
+  fclose(f);
+  return ok;
+}
+
+// writes |s| as a JSON string
+static void print_json_string(FILE *out, const char *s) {
+  fputc('"', out);
+  for (; *s; ++s) {
+    if (*s == '"' || *s == '\\')
+      fputc('\\', out);
+    fputc(*s, out);
+  }
+  fputc('"', out);
+}
+
+// replays |w| once and reports its throughput, latencies and hit rate
+static void bench(FILE *out, const workload_t *w, const workload_options_t *options, int rep) {
+  static stats_t stats;
+  static stats_histogram_t latency;
+
+  stats_reset();
+  uint64_t start = stats_now();
+  run_workload(w->path, options);
+  double seconds = (stats_now() - start) / 1e9;
+  stats_get(&stats);
+
+  // reads and writes together
+  const stats_histogram_t *reads = &stats.histograms[STATS_READ_LATENCY];
+  const stats_histogram_t *writes = &stats.histograms[STATS_WRITE_LATENCY];
+  latency.count = reads->count + writes->count;
+  latency.sum_ns = reads->sum_ns + writes->sum_ns;
+  latency.min_ns = reads->count == 0 ? writes->min_ns
+                 : writes->count == 0 || reads->min_ns < writes->min_ns ? reads->min_ns : writes->min_ns;
+  latency.max_ns = reads->max_ns > writes->max_ns ? reads->max_ns : writes->max_ns;
+  for (int b = 0; b < STATS_NUM_BUCKETS; ++b)
+    latency.buckets[b] = reads->buckets[b] + writes->buckets[b];
+
+  uint64_t ops = stats.counters[STATS_READS] + stats.counters[STATS_WRITES];
+  uint64_t bytes = stats.counters[STATS_READ_BYTES] + stats.counters[STATS_WRITE_BYTES];
+  uint64_t lookups = stats.counters[STATS_CACHE_HITS] + stats.counters[STATS_CACHE_MISSES];
+  uint64_t jbod_ops = 0;
+  for (int i = 0; i < JBOD_NUM_CMDS; ++i)
+    jbod_ops += stats.jbod_ops[i];
+
+  double ops_per_sec = ops / seconds, mb_per_sec = bytes / seconds / 1e6;
+  double hit_rate = lookups == 0 ? 0 : 100.0 * stats.counters[STATS_CACHE_HITS] / lookups;
+  uint64_t misses = stats.counters[STATS_CACHE_MISSES];
+  double l2_hit_rate = misses == 0 ? 0 : 100.0 * stats.counters[STATS_L2_HITS] / misses;
+  uint64_t p50 = stats_percentile(&latency, 50), p99 = stats_percentile(&latency, 99);
+  uint64_t p999 = stats_percentile(&latency, 99.9);
+
+  fprintf(out, "{\"workload\": ");
+  print_json_string(out, w->name);
+  fprintf(out, ", \"cache_size\": %d, \"policy\": \"%s\", \"write_back\": %s, \"read_ahead\": %s, \"layout\": \"%s\"",
+          options->cache_size, options->cache_size ? cache_policy_name(options->policy) : "none",
+          options->write_back ? "true" : "false", options->read_ahead ? "true" : "false", layout_names[options->layout]);
+  fprintf(out, ", \"stripe_unit\": %d", options->layout == MDADM_LAYOUT_STRIPED ? options->stripe_unit : 0);
+  fprintf(out, ", \"repetition\": %d", rep);
+  fprintf(out, ", \"ops\": %lu, \"bytes\": %lu, \"jbod_ops\": %lu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, \"mb_per_sec\": %.3f",
+          (unsigned long)ops, (unsigned long)bytes, (unsigned long)jbod_ops, seconds, ops_per_sec, mb_per_sec);
+  fprintf(out, ", \"mean_ns\": %lu, \"p50_ns\": %lu, \"p99_ns\": %lu, \"p999_ns\": %lu, \"hit_rate\": %.2f",
+          (unsigned long)(latency.count == 0 ? 0 : latency.sum_ns / latency.count), (unsigned long)p50,
+          (unsigned long)p99, (unsigned long)p999, hit_rate);
+  fprintf(out, ", \"l2_size\": %d, \"l2_hit_rate\": %.2f}\n", options->l2_size, l2_hit_rate);
+  fflush(out);
+
+  fprintf(stderr, "%-28s %6d %-5s #%d: %10.0f ops/s %8.2f MB/s  p50 %8lu  p99 %8lu  p999 %8lu ns  hits %5.1f%%",
+          w->name, options->cache_size, options->cache_size ? cache_policy_name(options->policy) : "-", rep,
+          ops_per_sec, mb_per_sec, (unsigned long)p50, (unsigned long)p99, (unsigned long)p999, hit_rate);
+  if (options->l2_size && options->cache_size)
+    fprintf(stderr, "  l2 hits %5.1f%%", l2_hit_rate);
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+  workload_t workloads[MAX_WORKLOADS];
+  bool patterns[BENCH_NUM_PATTERNS] = {false};
+  bool policies[CACHE_NUM_POLICIES] = {false};
+  int cache_sizes[MAX_CACHE_SIZES];
+  int num_workloads = 0, num_patterns = 0, num_cache_sizes = 0;
+  int ch, ops = BENCH_DEFAULT_OPS, io_size = BENCH_DEFAULT_IO_SIZE, write_percent = BENCH_DEFAULT_WRITE_PERCENT;
+  int repetitions = 3, num_conns = 1, num_servers = 1, stripe_unit = 0, l2_size = 0;
+  mdadm_layout_t layout = MDADM_LAYOUT_LINEAR;
+  jbod_server_t servers[JBOD_MAX_SERVERS] = {{JBOD_SERVER, JBOD_PORT}};
+  bool write_back = false, read_ahead = false, workers = false, local = false;
+  char default_sizes[] = "0,1024", default_policies[] = "lru";
+  char *results_file = NULL, *sizes = default_sizes, *policy_names = default_policies;
+  bench_pattern_t pattern;
+  cache_policy_t policy;
+  glob_t traces = {0};
+
+  rand_state = 1;
+  while ((ch = getopt(argc, argv, BENCH_ARGUMENTS)) != -1) {
+    switch (ch) {
+      case 'h':
+        fprintf(stderr, USAGE);
+        return 0;
+      case 'w':
+        if (num_workloads == MAX_WORKLOADS)
+          errx(1, "Too many workloads, aborting.");
+        if (strlen(optarg) >= sizeof(workloads[0].path))
+          errx(1, "Workload path too long (%s), aborting.", optarg);
+        workloads[num_workloads].name = optarg;
+        strcpy(workloads[num_workloads].path, optarg);
+        workloads[num_workloads++].generated = false;
+        break;
+      case 'g':
+        for (pattern = 0; pattern < BENCH_NUM_PATTERNS; ++pattern)
+          if (strcmp(optarg, pattern_names[pattern]) == 0)
+            break;
+        if (pattern == BENCH_NUM_PATTERNS) {
+          fprintf(stderr, "Unknown pattern (%s), aborting.\n", optarg);
+          return -1;
+        }
+        num_patterns += !patterns[pattern];
+        patterns[pattern] = true;
+        break;
+      case 'n':
+        ops = atoi(optarg);
+        break;
+      case 'z':
+        io_size = atoi(optarg);
+        break;
+      case 'm':
+        write_percent = atoi(optarg);
+        break;
+      case 'S':
+        rand_state = strtoull(optarg, NULL, 0) | 1;
+        break;
+      case 'x':
+        repetitions = atoi(optarg);
+        break;
+      case 's':
+        sizes = optarg;
+        break;
+      case 'p':
+        policy_names = optarg;
+        break;
+      case 'b':
+        write_back = true;
+        break;
+      case 'r':
+        read_ahead = true;
+        break;
+      case 't':
+        workers = true;
+        break;
+      case 'l':
+        local = true;
+        break;
+      case 'c':
+        num_conns = atoi(optarg);
+        break;
+      case 'e':
+        num_servers = jbod_parse_servers(optarg, servers, JBOD_MAX_SERVERS);
+        if (num_servers == -1) {
+          fprintf(stderr, "Bad server list (%s), aborting.\n", optarg);
+          return -1;
+        }
+        break;
+      case 'u':
+        layout = MDADM_LAYOUT_STRIPED;
+        stripe_unit = atoi(optarg);
+        break;
+      case 'M':
+        layout = MDADM_LAYOUT_MIRRORED;
+        break;
+      case 'L':
+        l2_size = atoi(optarg);
+        break;
+      case 'T':
+        jbod_set_connect_timeout(atoi(optarg));
+        break;
+      case 'o':
+        results_file = optarg;
+        break;
+      default:
+        fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+        return -1;
+    }
+  }
+
+  // a single server mirrored onto itself holds half as much
+  uint32_t space = MDADM_MAX_IO_SIZE;
+  if (layout == MDADM_LAYOUT_MIRRORED && (local || num_servers == 1))
+    space /= 2;
+
+  if (ops < 1 || io_size < 1 || io_size > space || write_percent < 0 || write_percent > 100 ||
+      repetitions < 1 || (local && workers) || (workers && num_servers > 1)) {
+    fprintf(stderr, USAGE);
+    return -1;
+  }
+
+  for (char *s = strtok(sizes, ","); s; s = strtok(NULL, ",")) {
+    if (num_cache_sizes == MAX_CACHE_SIZES)
+      errx(1, "Too many cache sizes, aborting.");
+    cache_sizes[num_cache_sizes++] = atoi(s);
+  }
+  for (char *s = strtok(policy_names, ","); s; s = strtok(NULL, ",")) {
+    for (policy = 0; policy < CACHE_NUM_POLICIES; ++policy)
+      if (strcmp(s, cache_policy_name(policy)) == 0)
+        break;
+    if (policy == CACHE_NUM_POLICIES) {
+      fprintf(stderr, "Unknown cache policy (%s), aborting.\n", s);
+      return -1;
+    }
+    policies[policy] = true;
+  }
+
+  // without a workload, every trace that fits the device and every pattern
+  if (num_workloads == 0 && num_patterns == 0) {
+    if (glob(BENCH_TRACES, 0, NULL, &traces) == 0) {
+      for (size_t i = 0; i < traces.gl_pathc && num_workloads < MAX_WORKLOADS; ++i) {
+        if (!fits(traces.gl_pathv[i], space)) {
+          fprintf(stderr, "Skipping %s, it does not fit the device.\n", traces.gl_pathv[i]);
+          continue;
+        }
+        workloads[num_workloads].name = traces.gl_pathv[i];
+        snprintf(workloads[num_workloads].path, sizeof(workloads[0].path), "%s", traces.gl_pathv[i]);
+        workloads[num_workloads++].generated = false;
+      }
+    }
+    for (pattern = 0; pattern < BENCH_NUM_PATTERNS; ++pattern)
+      patterns[pattern] = true;
+  }
+  for (pattern = 0; pattern < BENCH_NUM_PATTERNS; ++pattern)
+    if (patterns[pattern] && num_workloads < MAX_WORKLOADS)
+      generate(&workloads[num_workloads++], pattern, ops, io_size, write_percent, space);
+
+  FILE *out = results_file ? fopen(results_file, "a") : stdout;
+  if (!out)
+    err(1, "Cannot open results file %s", results_file);
+
+  if (!local && !jbod_connect_servers(servers, num_servers, num_conns))
+    errx(1, "Failed to connect to the JBOD servers.");
+  if (workers && mdadm_start_workers(servers[0].ip, servers[0].port) != 1)
+    errx(1, "Failed to start the I/O workers.");
+
+  for (int i = 0; i < num_workloads; ++i)
+    for (int s = 0; s < num_cache_sizes; ++s)
+      for (policy = 0; policy < CACHE_NUM_POLICIES; ++policy) {
+        if (!policies[policy])
+          continue;
+        workload_options_t options = {
+          .cache_size = cache_sizes[s],
+          .policy = policy,
+          .backend = local ? MDADM_BACKEND_LOCAL : MDADM_BACKEND_NETWORK,
+          .layout = layout,
+          .stripe_unit = stripe_unit,
+          .write_back = write_back && cache_sizes[s],
+          .read_ahead = read_ahead && cache_sizes[s],
+          .l2_size = l2_size,
+          .l2_file = L2CACHE_DEFAULT_FILE,
+          .signatures = NULL,
+          .report = false,
+        };
+        for (int rep = 0; rep < repetitions; ++rep)
+          bench(out, &workloads[i], &options, rep);
+        // without a cache the policy makes no difference
+        if (cache_sizes[s] == 0)
+          break;
+      }
+
+  mdadm_stop_workers();
+  jbod_disconnect();
+  if (results_file)
+    fclose(out);
+
+  for (int i = 0; i < num_workloads; ++i)
+    if (workloads[i].generated)
+      unlink(workloads[i].path);
+  globfree(&traces);
+
+  return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include "mdadm.h"
+
+/* Synthetic access patterns the benchmark can generate workloads from. */
+typedef enum {
+  BENCH_SEQUENTIAL,  /* consecutive requests, wrapping at the end of the disks */
+  BENCH_RANDOM,      /* uniformly random requests */
+  BENCH_ZIPFIAN,     /* a few popular requests and a long tail */
+  BENCH_HOTSET,      /* most requests to a small contiguous region */
+  BENCH_NUM_PATTERNS,
+} bench_pattern_t;
+
+/* Defaults of a generated workload. */
+#define BENCH_DEFAULT_OPS 20000
+#define BENCH_DEFAULT_IO_SIZE 256
+#define BENCH_DEFAULT_WRITE_PERCENT 30
+
+/* Skew of the zipfian pattern; request k is picked with a probability
+ * proportional to 1 / k^BENCH_ZIPF_THETA. */
+#define BENCH_ZIPF_THETA 0.99
+
+/* The hot set pattern sends BENCH_HOT_ACCESS_PERCENT of its requests to
+ * BENCH_HOT_SET_PERCENT of the address space. */
+#define BENCH_HOT_SET_PERCENT 10
+#define BENCH_HOT_ACCESS_PERCENT 90
+
+/* Where the replayed trace files are looked up when no workload is given. */
+#define BENCH_TRACES "traces/*-input"
+
+#endif
@@ -1,21 +1,179 @@
 #include "cache.h"
+#include "l2cache.h"
+#include "net.h"
+#include "policy.h"
+#include "stats.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-static cache_entry_t *cache = NULL;
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// a clean block evicted from a shard on its way to the second level, which it is handed to once the lock of the shard
+// is let go of
+typedef struct evicted {
+    int disk_num;
+    int block_num;
+    uint8_t block[JBOD_BLOCK_SIZE];
+    struct evicted *next;
+} evicted_t;
+
+// one independently locked part of the cache; a block always lives in the shard its key hashes to
+typedef struct {
+    pthread_mutex_t lock;
+    cache_entry_t *entries;
+
+    // the blocks of the shard on their way to the second level, and signalled whenever one got there
+    evicted_t *evicting;
+    pthread_cond_t evicted;
+
+    // hash chains over the slots of entries: buckets[b] is the first slot in bucket b, hash_next[slot] the next one, -1 ends
+    int *hash_next;
+    int *buckets;
+    int num_buckets;
+
+    int size;     // number of slots in entries
+    int num_used; // number of slots handed out so far; slots [0, num_used) hold valid entries
+
+    // decides which entry of the shard is evicted when the shard is full
+    policy_t *policy;
+} cache_shard_t;
+
+static cache_shard_t *shards = NULL;
+static int num_shards = 0;
+static int shard_bits = 0;
 static int cache_size = 0;
-static int clock = 0;
-static int num_queries = 0;
-static int num_hits = 0;
+static atomic_int access_clock = 0;
+static atomic_int num_queries = 0;
+static atomic_int num_hits = 0;
+static atomic_int num_l2_hits = 0;
+
+// where the second level keeps the blocks evicted from the cache and how many it keeps; NULL for no second level
+static char *l2_path = NULL;
+static int l2_size = 0;
+
+// where dirty blocks go in write-back mode; NULL while the cache is write-through
+static cache_writeback_t writeback = NULL;
+
+// told whether read-ahead blocks were used before being evicted
+static cache_prefetch_hook_t prefetch_hook = NULL;
+
+// where the contents of the cache outlive the process, and the generation of the disks they have to match; NULL while
+// the cache is not persistent
+static char *snapshot_path = NULL;
+static uint64_t snapshot_generation = 0;
+
+static void load_snapshot(void);
 
 // it keeps track of whether the cache has been created or destroyed (0 or 1)
 int cache_intialized = 0;
 
 // it keeps track of whether any entries have been inserted into the cache (0 or 1)
-int cache_populated = 0;
+atomic_int cache_populated = 0;
+
+// names the block at (disk_num, block_num) with a single number
+static uint32_t key_of(int disk_num, int block_num) { return (uint32_t)disk_num * JBOD_NUM_BLOCKS_PER_DISK + (uint32_t)block_num; }
+
+// spreads keys over 32 bits; the top bits pick the shard and lower bits the bucket within it
+static uint32_t hash_of(int disk_num, int block_num) { return key_of(disk_num, block_num) * 2654435761u; }
+
+static cache_shard_t *shard_of(int disk_num, int block_num) {
+    return shard_bits == 0 ? &shards[0] : &shards[hash_of(disk_num, block_num) >> (32 - shard_bits)];
+}
+
+// maps (disk_num, block_num) to a bucket; num_buckets is a power of two so masking replaces the modulo
+static int bucket_of(const cache_shard_t *shard, int disk_num, int block_num) { return (int)(hash_of(disk_num, block_num) >> 7) & (shard->num_buckets - 1); }
+
+// returns the slot of the shard holding (disk_num, block_num), or -1 if the block is not cached
+static int find_slot(const cache_shard_t *shard, int disk_num, int block_num) {
+    for (int i = shard->buckets[bucket_of(shard, disk_num, block_num)]; i != -1; i = shard->hash_next[i]) {
+        if ((shard->entries[i].disk_num == disk_num) && (shard->entries[i].block_num == block_num)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void hash_add(cache_shard_t *shard, int slot) {
+    int b = bucket_of(shard, shard->entries[slot].disk_num, shard->entries[slot].block_num);
+    shard->hash_next[slot] = shard->buckets[b];
+    shard->buckets[b] = slot;
+}
+
+static void hash_remove(cache_shard_t *shard, int slot) {
+    int *p = &shard->buckets[bucket_of(shard, shard->entries[slot].disk_num, shard->entries[slot].block_num)];
+    while (*p != slot) {
+        p = &shard->hash_next[*p];
+    }
+    *p = shard->hash_next[slot];
+}
+
+// waits, with the lock of the shard held, until the block is not on its way to the second level any more, so that a
+// newer version of it is not overwritten there by the older one
+static void wait_evicted(cache_shard_t *shard, int disk_num, int block_num) {
+    evicted_t *e = shard->evicting;
+    while (e != NULL) {
+        if (e->disk_num == disk_num && e->block_num == block_num) {
+            pthread_cond_wait(&shard->evicted, &shard->lock);
+            e = shard->evicting;
+        } else {
+            e = e->next;
+        }
+    }
+}
+
+// marks the slot as just used: bumps the clock and lets the policy know
+static void touch(cache_shard_t *shard, int slot) {
+    shard->entries[slot].access_time = atomic_fetch_add(&access_clock, 1) + 1;
+    policy_hit(shard->policy, slot);
+}
+
+static void free_shard(cache_shard_t *shard) {
+    free(shard->entries);
+    free(shard->hash_next);
+    free(shard->buckets);
+    policy_destroy(shard->policy);
+    pthread_cond_destroy(&shard->evicted);
+    pthread_mutex_destroy(&shard->lock);
+}
+
+static int init_shard(cache_shard_t *shard, int size, cache_policy_t kind) {
+
+    // keep the load factor at or below one half so hash chains stay short
+    shard->num_buckets = 1;
+    while (shard->num_buckets < 2 * size) {
+        shard->num_buckets <<= 1;
+    }
+
+    pthread_mutex_init(&shard->lock, NULL);
+    pthread_cond_init(&shard->evicted, NULL);
+    shard->evicting = NULL;
+    shard->entries = calloc(size, sizeof(cache_entry_t));
+    shard->hash_next = malloc(size * sizeof(int));
+    shard->buckets = malloc(shard->num_buckets * sizeof(int));
+    shard->policy = policy_create(kind, size);
+    if (shard->entries == NULL || shard->hash_next == NULL || shard->buckets == NULL || shard->policy == NULL) {
+        free_shard(shard);
+        return -1;
+    }
+    for (int i = 0; i < shard->num_buckets; i++) {
+        shard->buckets[i] = -1;
+    }
+
+    shard->size = size;
+    shard->num_used = 0;
+    return 1;
+}
 
-int cache_create(int num_entries) {
+int cache_create(int num_entries) { return cache_create_with_policy(num_entries, CACHE_POLICY_LRU); }
+
+int cache_create_with_policy(int num_entries, cache_policy_t kind) {
 
     // checks for failures from test_cache_create_destroy()
     if (num_entries < 2 || num_entries > 4096) {
@@ -24,9 +182,43 @@ int cache_create(int num_entries) {
 
     // if cache is not created, then start with the create operation by dynamically allocating space for cache
     if (cache_intialized == 0) {
-        cache = calloc(num_entries, sizeof(cache_entry_t));
+
+        // the second level, if there is to be one, takes the blocks the shards evict
+        if (l2_path != NULL && l2cache_create(l2_path, l2_size) == -1) {
+            return -1;
+        }
+
+        // use as many shards as keeps each of them at a useful size; small caches stay one exact shard
+        shard_bits = 0;
+        while ((1 << shard_bits) < CACHE_MAX_SHARDS && (num_entries >> (shard_bits + 1)) >= CACHE_MIN_SHARD_SIZE) {
+            shard_bits++;
+        }
+        num_shards = 1 << shard_bits;
+
+        shards = calloc(num_shards, sizeof(cache_shard_t));
+        if (shards == NULL) {
+            l2cache_destroy();
+            return -1;
+        }
+
+        // spread the entries evenly, the first shards taking one more while there are leftovers
+        for (int i = 0; i < num_shards; i++) {
+            int size = num_entries / num_shards + (i < num_entries % num_shards ? 1 : 0);
+            if (init_shard(&shards[i], size, kind) == -1) {
+                while (--i >= 0) {
+                    free_shard(&shards[i]);
+                }
+                free(shards);
+                shards = NULL;
+                num_shards = 0;
+                l2cache_destroy();
+                return -1;
+            }
+        }
+
         cache_size = num_entries;
         cache_intialized = 1;
+        load_snapshot();
         return 1;
     }
     return -1;
@@ -36,123 +228,584 @@ int cache_destroy(void) {
 
     // if cache has already been created, then start with the destroying operation
     if (cache_intialized == 1) {
-        free(cache);
-        cache = NULL;
+
+        // dirty blocks exist nowhere else, so give them a last chance to reach the disks. The snapshot is left to
+        // mdadm_unmount: the disks may still be mounted here and change once the cache is gone
+        int rc = cache_flush();
+        writeback = NULL;
+
+        for (int i = 0; i < num_shards; i++) {
+            free_shard(&shards[i]);
+        }
+        free(shards);
+        shards = NULL;
+        num_shards = 0;
+        shard_bits = 0;
+        l2cache_destroy();
         cache_size = 0;
         cache_intialized = 0;
         cache_populated = 0;
-        clock = 0;
-        return 1;
+        access_clock = 0;
+        return rc == -1 ? -1 : 1;
     }
 
     return -1;
 }
 
+static int insert_entry(int disk_num, int block_num, const uint8_t *buf, bool prefetched);
+
+// moves the block from the second level back into the cache; returns true if it was there
+static bool promote(int disk_num, int block_num) {
+    uint8_t block[JBOD_BLOCK_SIZE];
+
+    if (l2cache_take(disk_num, block_num, block) == -1) {
+        return false;
+    }
+    return insert_entry(disk_num, block_num, block, false) == 1;
+}
+
+// counts a query for the block and, if it is cached, a hit, which is a hit of the second level if the block has to be
+// promoted from there first; returns its slot with the lock of its shard held, or -1
+static int lookup_slot(cache_shard_t *shard, int disk_num, int block_num) {
+    atomic_fetch_add(&num_queries, 1);
+
+    pthread_mutex_lock(&shard->lock);
+    int slot = find_slot(shard, disk_num, block_num);
+    if (slot == -1) {
+        pthread_mutex_unlock(&shard->lock);
+        stats_add(STATS_CACHE_MISSES, 1);
+        if (!promote(disk_num, block_num)) {
+            return -1;
+        }
+
+        // an entry of the shard may be evicted again before the lock is back, but then the block went to the second
+        // level, which is as good as a miss here
+        pthread_mutex_lock(&shard->lock);
+        slot = find_slot(shard, disk_num, block_num);
+        if (slot == -1) {
+            pthread_mutex_unlock(&shard->lock);
+            return -1;
+        }
+        atomic_fetch_add(&num_l2_hits, 1);
+        stats_add(STATS_L2_HITS, 1);
+    } else {
+        atomic_fetch_add(&num_hits, 1);
+        stats_add(STATS_CACHE_HITS, 1);
+    }
+    touch(shard, slot);
+    if (shard->entries[slot].prefetched) {
+        shard->entries[slot].prefetched = false;
+        if (prefetch_hook != NULL) {
+            prefetch_hook(disk_num, block_num, true);
+        }
+    }
+    return slot;
+}
+
 int cache_lookup(int disk_num, int block_num, uint8_t *buf) {
 
     // checks if anything has been inserted in cache
-    if (cache_populated == 0) {
+    if (cache_populated == 0 || buf == NULL) {
         return -1;
     }
 
-    num_queries++;
-    for (int i = 0; i < cache_size; i++) {
+    // lookup the block identified by disk_num and block_num in the cache; if found then copy the block into buf
+    cache_shard_t *shard = shard_of(disk_num, block_num);
+    int slot = lookup_slot(shard, disk_num, block_num);
+    if (slot == -1) {
+        return -1;
+    }
+    memcpy(buf, shard->entries[slot].block, JBOD_BLOCK_SIZE);
+    pthread_mutex_unlock(&shard->lock);
+    return 1;
+}
 
-        // lookup the block identified by disk_num and block_num in the cache; if found then copy the block into buf (!= NULL)
-        if ((cache[i].disk_num == disk_num) && (cache[i].block_num == block_num) && (buf != NULL)) {
-            num_hits++;
-            clock++;
-            cache[i].access_time = clock;
-            memcpy(buf, cache[i].block, JBOD_BLOCK_SIZE);
-            return 1;
-        }
+const uint8_t *cache_pin(int disk_num, int block_num) {
+    if (cache_populated == 0) {
+        return NULL;
     }
 
-    return -1;
+    // the entry stays where it is until its last pin is released, so the block can be read without the lock
+    cache_shard_t *shard = shard_of(disk_num, block_num);
+    int slot = lookup_slot(shard, disk_num, block_num);
+    if (slot == -1) {
+        return NULL;
+    }
+    cache_entry_t *entry = &shard->entries[slot];
+    if (entry->pins++ == 0) {
+        policy_pin(shard->policy, slot, true);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return entry->block;
+}
+
+void cache_unpin(const uint8_t *block) {
+    if (cache_intialized == 0 || block == NULL) {
+        return;
+    }
+
+    // a pinned block is still part of the entry it was handed out from, which keeps its disk and block number
+    cache_entry_t *entry = (cache_entry_t *)(block - offsetof(cache_entry_t, block));
+    cache_shard_t *shard = shard_of(entry->disk_num, entry->block_num);
+    pthread_mutex_lock(&shard->lock);
+    if (entry->pins > 0 && --entry->pins == 0) {
+        policy_pin(shard->policy, (int)(entry - shard->entries), false);
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+// writes the dirty entry in slot back with the lock of its shard let go of, so that the shard is not held up by the
+// network meanwhile; the entry stays pinned where it is. Returns 1 on success and -1 on failure, when it stays dirty
+static int clean_entry(cache_shard_t *shard, int slot) {
+    cache_entry_t *entry = &shard->entries[slot];
+    int disk_num = entry->disk_num;
+    int block_num = entry->block_num;
+    uint8_t block[JBOD_BLOCK_SIZE];
+
+    memcpy(block, entry->block, JBOD_BLOCK_SIZE);
+    entry->dirty = false;
+    if (entry->pins++ == 0) {
+        policy_pin(shard->policy, slot, true);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    int rc = writeback(disk_num, block_num, block);
+    pthread_mutex_lock(&shard->lock);
+    if (--entry->pins == 0) {
+        policy_pin(shard->policy, slot, false);
+    }
+
+    // a write meanwhile may have reached the disk ahead of this older copy, so a block that changed goes out again
+    if (rc != 1 || memcmp(entry->block, block, JBOD_BLOCK_SIZE) != 0) {
+        entry->dirty = true;
+    }
+    if (rc != 1) {
+        return -1;
+    }
+    stats_add(STATS_CACHE_WRITEBACKS, 1);
+    return 1;
+}
+
+// hands a block evicted from the shard to the second level, then takes it off the blocks on their way there
+static void finish_eviction(cache_shard_t *shard, evicted_t *evicted) {
+    if (l2cache_insert(evicted->disk_num, evicted->block_num, evicted->block) == 1) {
+        stats_add(STATS_L2_INSERTS, 1);
+    }
+
+    pthread_mutex_lock(&shard->lock);
+    evicted_t **p = &shard->evicting;
+    while (*p != evicted) {
+        p = &(*p)->next;
+    }
+    *p = evicted->next;
+    pthread_cond_broadcast(&shard->evicted);
+    pthread_mutex_unlock(&shard->lock);
 }
 
-int cache_insert(int disk_num, int block_num, const uint8_t *buf) {
+// inserts the block into its shard, marking it as read ahead if asked to; returns 1 on success and -1 on failure
+static int insert_entry(int disk_num, int block_num, const uint8_t *buf, bool prefetched) {
 
-    int location = -1;
-    int lowest_access_time;
+    int location;
+    bool evict = false, spill = false;
+    evicted_t evicted;
 
     // checks for failures from test_cache_invalid_parameters()
     if (cache_intialized == 0 || buf == NULL || cache_size == 0) {
         return -1;
     }
-    if (disk_num > 16 || disk_num < 0 || block_num > 256 || block_num < 0) {
+    if (disk_num >= JBOD_MAX_DISKS || disk_num < 0 || block_num >= JBOD_NUM_BLOCKS_PER_DISK || block_num < 0) {
         return -1;
     }
 
-    // indicates that cache has at least one valid entry
-    cache_populated = 1;
+    cache_shard_t *shard = shard_of(disk_num, block_num);
+    pthread_mutex_lock(&shard->lock);
 
-    // using linear search to find an empty slot in the cache
-    for (int i = 0; i < cache_size; i++) {
+    // take the next unused slot while there is one, otherwise evict the entry the replacement policy picks; writing a
+    // dirty victim back lets go of the lock, after which everything is looked at again
+    while (true) {
+        wait_evicted(shard, disk_num, block_num);
 
         // inserting an entry with the same disk_num and block_num should fail
-        if ((cache[i].disk_num == disk_num) && (cache[i].block_num == block_num) && (block_num != 0) && (disk_num != 0)) {
+        if (find_slot(shard, disk_num, block_num) != -1) {
+            pthread_mutex_unlock(&shard->lock);
+            return -1;
+        }
+        if (shard->num_used < shard->size) {
+            location = shard->num_used++;
+            break;
+        }
+        location = policy_victim(shard->policy, key_of(disk_num, block_num));
+
+        // nothing can be evicted while every entry of the shard is pinned
+        if (location == -1) {
+            pthread_mutex_unlock(&shard->lock);
             return -1;
         }
 
-        if (cache[i].valid == 0) {
-            location = i;
+        // a dirty victim has to be written back before its slot can be reused
+        if (!shard->entries[location].dirty) {
+            evict = true;
             break;
         }
+        if (clean_entry(shard, location) == -1) {
+            pthread_mutex_unlock(&shard->lock);
+            return -1;
+        }
+    }
+
+    if (evict) {
+        cache_entry_t *victim = &shard->entries[location];
+        stats_add(STATS_CACHE_EVICTIONS, 1);
+        if (victim->prefetched && prefetch_hook != NULL) {
+            prefetch_hook(victim->disk_num, victim->block_num, false);
+        }
+        hash_remove(shard, location);
+        policy_evict(shard->policy, location);
+
+        // the victim is clean, so the second level can hand it back as it is once the lock is let go of
+        if (l2cache_enabled()) {
+            evicted.disk_num = victim->disk_num;
+            evicted.block_num = victim->block_num;
+            memcpy(evicted.block, victim->block, JBOD_BLOCK_SIZE);
+            evicted.next = shard->evicting;
+            shard->evicting = &evicted;
+            spill = true;
+        }
+    }
+
+    // the block is in one level at a time, and whatever the second level has of it is older than buf
+    l2cache_remove(disk_num, block_num);
+
+    cache_entry_t *entry = &shard->entries[location];
+
+    // copy the buffer buf into the block of the corresponding entry in the cache
+    memcpy(entry->block, buf, JBOD_BLOCK_SIZE);
+
+    // update disk_num and block_num of the corresponding entry in the cache
+    entry->disk_num = disk_num;
+    entry->block_num = block_num;
+
+    // indicates that the block has valid data, which matches what is on disk until marked dirty
+    entry->valid = 1;
+    entry->dirty = false;
+    entry->prefetched = prefetched;
+    entry->pins = 0;
+
+    // link the entry into its bucket and hand it to the replacement policy
+    hash_add(shard, location);
+    policy_insert(shard->policy, location, key_of(disk_num, block_num));
+    entry->access_time = atomic_fetch_add(&access_clock, 1) + 1;
+    pthread_mutex_unlock(&shard->lock);
+    stats_add(STATS_CACHE_INSERTS, 1);
+    if (spill) {
+        finish_eviction(shard, &evicted);
+    }
+
+    // indicates that cache has at least one valid entry
+    cache_populated = 1;
+    return 1;
+}
+
+int cache_insert(int disk_num, int block_num, const uint8_t *buf) { return insert_entry(disk_num, block_num, buf, false); }
+
+int cache_insert_prefetch(int disk_num, int block_num, const uint8_t *buf) { return insert_entry(disk_num, block_num, buf, true); }
+
+bool cache_contains(int disk_num, int block_num) {
+    if (cache_intialized == 0) {
+        return false;
+    }
+
+    cache_shard_t *shard = shard_of(disk_num, block_num);
+    pthread_mutex_lock(&shard->lock);
+    bool found = find_slot(shard, disk_num, block_num) != -1;
+    pthread_mutex_unlock(&shard->lock);
+    return found || l2cache_contains(disk_num, block_num);
+}
+
+void cache_set_prefetch_hook(cache_prefetch_hook_t hook) { prefetch_hook = hook; }
+
+void cache_update(int disk_num, int block_num, const uint8_t *buf) {
+
+    if (cache_intialized == 0 || buf == NULL) {
+        return;
+    }
+
+    // if the entry exists in cache, updates its block content with the new data in buf, also update the access_time
+    cache_shard_t *shard = shard_of(disk_num, block_num);
+    pthread_mutex_lock(&shard->lock);
+    int slot = find_slot(shard, disk_num, block_num);
+    if (slot != -1) {
+        memcpy(shard->entries[slot].block, buf, JBOD_BLOCK_SIZE);
+        touch(shard, slot);
+    } else {
+
+        // a copy in the second level would be stale now, as would one still on its way there
+        wait_evicted(shard, disk_num, block_num);
+        l2cache_remove(disk_num, block_num);
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
+
+int cache_set_write_back(cache_writeback_t fn) {
+    if (cache_intialized == 0) {
+        return -1;
+    }
+
+    // leaving write-back mode must not strand dirty blocks in the cache
+    if (fn == NULL && cache_flush() == -1) {
+        return -1;
+    }
+    writeback = fn;
+    return 1;
+}
+
+int cache_mark_dirty(int disk_num, int block_num) {
+    if (cache_intialized == 0 || writeback == NULL) {
+        return -1;
+    }
+
+    cache_shard_t *shard = shard_of(disk_num, block_num);
+    pthread_mutex_lock(&shard->lock);
+    int slot = find_slot(shard, disk_num, block_num);
+    if (slot != -1) {
+        shard->entries[slot].dirty = true;
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return slot == -1 ? -1 : 1;
+}
+
+// orders entries by their (disk_num, block_num)
+static int compare_entries(const void *a, const void *b) {
+    const cache_entry_t *x = *(cache_entry_t *const *)a;
+    const cache_entry_t *y = *(cache_entry_t *const *)b;
+    if (x->disk_num != y->disk_num) {
+        return x->disk_num - y->disk_num;
+    }
+    return x->block_num - y->block_num;
+}
+
+int cache_flush(void) {
+    if (cache_intialized == 0) {
+        return -1;
+    }
+    if (writeback == NULL) {
+        return 1;
     }
 
-    // if no empty slot is found
-    if (location == -1) {
+    cache_entry_t **dirty = malloc(cache_size * sizeof(cache_entry_t *));
+    int num_dirty = 0;
+    int rc = 1;
+    if (dirty == NULL) {
+        return -1;
+    }
 
-        lowest_access_time = cache[0].access_time;
-        location = 0;
+    // hold every shard, always locked in index order, so the flush sees and writes back one consistent set
+    for (int s = 0; s < num_shards; s++) {
+        pthread_mutex_lock(&shards[s].lock);
+    }
 
-        // determine the entry with the smallest access_time and replace it with the new block of data
-        for (int i = 1; i < cache_size; i++) {
-            if (cache[i].access_time < lowest_access_time) {
-                lowest_access_time = cache[i].access_time;
-                location = i;
+    // collect the dirty entries and write them back sorted by disk and block
+    for (int s = 0; s < num_shards; s++) {
+        for (int i = 0; i < shards[s].num_used; i++) {
+            if (shards[s].entries[i].dirty) {
+                dirty[num_dirty++] = &shards[s].entries[i];
             }
         }
     }
+    qsort(dirty, num_dirty, sizeof(cache_entry_t *), compare_entries);
+
+    for (int i = 0; i < num_dirty; i++) {
+        if (writeback(dirty[i]->disk_num, dirty[i]->block_num, dirty[i]->block) == 1) {
+            dirty[i]->dirty = false;
+            stats_add(STATS_CACHE_WRITEBACKS, 1);
+        } else {
+            rc = -1;
+        }
+    }
 
-    // copy the buffer bef into the block of the corresponding entry in the cache
-    memcpy(cache[location].block, buf, JBOD_BLOCK_SIZE);
+    for (int s = num_shards - 1; s >= 0; s--) {
+        pthread_mutex_unlock(&shards[s].lock);
+    }
+    free(dirty);
+    return rc;
+}
 
-    // update disk_num and block_num of the corresponding entry in the cache
-    cache[location].disk_num = disk_num;
-    cache[location].block_num = block_num;
+// a snapshot file: a header, then count entries with the blocks, least recently used first
+#define SNAPSHOT_MAGIC 0x50534d43
 
-    // indicates that the block has valid data
-    cache[location].valid = 1;
+typedef struct {
+    uint32_t magic;
+    uint32_t block_size;
+    uint64_t generation; // of the disks the blocks were read from
+    uint32_t count;
+    uint32_t reserved;
+} snapshot_header_t;
 
-    // increment the clock
-    clock++;
+typedef struct {
+    int32_t disk_num;
+    int32_t block_num;
+    uint8_t block[JBOD_BLOCK_SIZE];
+} snapshot_entry_t;
 
-    // set the access_time of the corresponding entry to the current clock
-    cache[location].access_time = clock;
+int cache_set_snapshot(const char *path, uint64_t generation) {
+    char *copy = NULL;
 
+    if (cache_intialized == 1 || (path != NULL && (copy = strdup(path)) == NULL)) {
+        return -1;
+    }
+    free(snapshot_path);
+    snapshot_path = copy;
+    snapshot_generation = generation;
     return 1;
 }
 
-void cache_update(int disk_num, int block_num, const uint8_t *buf) {
+int cache_set_l2(const char *path, int num_entries) {
+    char *copy = NULL;
+
+    if (cache_intialized == 1 || (path != NULL && (num_entries < 1 || num_entries > L2CACHE_MAX_ENTRIES))) {
+        return -1;
+    }
+    if (path != NULL && (copy = strdup(path)) == NULL) {
+        return -1;
+    }
+    free(l2_path);
+    l2_path = copy;
+    l2_size = num_entries;
+    return 1;
+}
+
+void cache_discard_snapshot(void) {
+    if (snapshot_path != NULL) {
+        unlink(snapshot_path);
+    }
+}
+
+// orders entries from the least to the most recently used
+static int compare_access(const void *a, const void *b) {
+    const cache_entry_t *x = *(cache_entry_t *const *)a;
+    const cache_entry_t *y = *(cache_entry_t *const *)b;
+    return (x->access_time > y->access_time) - (x->access_time < y->access_time);
+}
+
+// fills the cache that was just created from its snapshot, oldest block first so the replacement policy ends up with
+// the saved recency order. The snapshot stays until the disks are mounted and may change behind it, so a cache that is
+// created and destroyed again before that finds it once more; a snapshot of another generation is stale and removed
+static void load_snapshot(void) {
+    struct stat st;
+    void *map = MAP_FAILED;
+
+    if (snapshot_path == NULL) {
+        return;
+    }
+    int fd = open(snapshot_path, O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(snapshot_header_t)) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    bool stale = true;
+    if (map != MAP_FAILED) {
+        const snapshot_header_t *header = map;
+        const snapshot_entry_t *entries = (const snapshot_entry_t *)(header + 1);
+        size_t room = (st.st_size - sizeof(*header)) / sizeof(*entries);
+
+        stale = header->magic != SNAPSHOT_MAGIC || header->block_size != JBOD_BLOCK_SIZE || header->generation != snapshot_generation ||
+                header->count > room;
+        if (!stale) {
+
+            // a snapshot of a larger cache keeps its most recently used blocks
+            uint32_t first = header->count > (uint32_t)cache_size ? header->count - cache_size : 0;
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            for (uint32_t i = first; i < header->count; i++) {
+                insert_entry(entries[i].disk_num, entries[i].block_num, entries[i].block, false);
+            }
+        }
+        munmap(map, st.st_size);
+    }
+    if (stale) {
+        cache_discard_snapshot();
+    }
+}
 
-    for (int i = 0; i < cache_size; i++) {
+int cache_save_snapshot(void) {
+    char tmp_path[PATH_MAX];
 
-        // if the entry exists in cache, updates its block content with the new data in buf, also update the access_time
-        if ((cache[i].disk_num == disk_num) && (cache[i].block_num == block_num)) {
-            memcpy(cache[i].block, buf, JBOD_BLOCK_SIZE);
-            clock++;
-            cache[i].access_time = clock;
+    if (cache_intialized == 0) {
+        return -1;
+    }
+    if (snapshot_path == NULL) {
+        return 1;
+    }
+
+    // written next to the snapshot and renamed over it, so a crash never leaves half of one behind
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", snapshot_path) >= (int)sizeof(tmp_path)) {
+        return -1;
+    }
+    cache_entry_t **saved = malloc(cache_size * sizeof(cache_entry_t *));
+    FILE *f = fopen(tmp_path, "wb");
+    if (saved == NULL || f == NULL) {
+        free(saved);
+        if (f != NULL) {
+            fclose(f);
+        }
+        return -1;
+    }
+
+    for (int s = 0; s < num_shards; s++) {
+        pthread_mutex_lock(&shards[s].lock);
+    }
+
+    // a dirty block never made it to the disks, so it would come back as something they do not hold
+    snapshot_header_t header = {.magic = SNAPSHOT_MAGIC, .block_size = JBOD_BLOCK_SIZE, .generation = snapshot_generation};
+    for (int s = 0; s < num_shards; s++) {
+        for (int i = 0; i < shards[s].num_used; i++) {
+            if (shards[s].entries[i].valid && !shards[s].entries[i].dirty) {
+                saved[header.count++] = &shards[s].entries[i];
+            }
         }
     }
+    qsort(saved, header.count, sizeof(cache_entry_t *), compare_access);
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    for (uint32_t i = 0; ok && i < header.count; i++) {
+        snapshot_entry_t entry = {.disk_num = saved[i]->disk_num, .block_num = saved[i]->block_num};
+        memcpy(entry.block, saved[i]->block, JBOD_BLOCK_SIZE);
+        ok = fwrite(&entry, sizeof(entry), 1, f) == 1;
+    }
+
+    for (int s = num_shards - 1; s >= 0; s--) {
+        pthread_mutex_unlock(&shards[s].lock);
+    }
+    free(saved);
+
+    if (fclose(f) != 0 || !ok || rename(tmp_path, snapshot_path) == -1) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 1;
+}
+
+const char *cache_policy_name(cache_policy_t kind) {
+    static const char *names[CACHE_NUM_POLICIES] = {"lru", "clock", "2q", "arc"};
+    if (kind < 0 || kind >= CACHE_NUM_POLICIES) {
+        return NULL;
+    }
+    return names[kind];
 }
 
 bool cache_enabled(void) {
-    if ((cache != NULL) && (cache_size > 0)) {
+    if ((shards != NULL) && (cache_size > 0)) {
         return true;
     }
     return false;
 }
 
-void cache_print_hit_rate(void) { fprintf(stderr, "Hit rate: %5.1f%%\n", 100 * (float)num_hits / num_queries); }
+// the second level sees the queries the first one misses
+void cache_print_hit_rate(void) {
+    fprintf(stderr, "Hit rate: %5.1f%%\n", 100 * (float)num_hits / num_queries);
+    if (l2_path != NULL) {
+        fprintf(stderr, "L2 hit rate: %5.1f%%\n", 100 * (float)num_l2_hits / (num_queries - num_hits));
+    }
+}
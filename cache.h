@@ -7,21 +7,61 @@
 #include "jbod.h"
 #include "util.h"
 
+/* The cache is split into up to CACHE_MAX_SHARDS shards of at least
+ * CACHE_MIN_SHARD_SIZE entries, picked by hashing (disk_num, block_num). Each
+ * shard has its own lock and replacement state, so lookups, inserts and
+ * updates may be called from several threads at once; creating, destroying
+ * and switching modes must not race with them. Caches too small to split
+ * are a single shard with exact replacement order. */
+#define CACHE_MAX_SHARDS 16
+#define CACHE_MIN_SHARD_SIZE 32
+
 typedef struct {
   bool valid;
   int disk_num;
   int block_num;
   uint8_t block[JBOD_BLOCK_SIZE];
   int access_time;
+  bool dirty;
+  bool prefetched;
+  int pins;
 } cache_entry_t;
 
+/* Replacement policies the cache can evict with. */
+typedef enum {
+  CACHE_POLICY_LRU,
+  CACHE_POLICY_CLOCK,
+  CACHE_POLICY_2Q,
+  CACHE_POLICY_ARC,
+  CACHE_NUM_POLICIES,
+} cache_policy_t;
+
+/* Writes a dirty block back to the disks on behalf of the cache. Returns 1 on
+ * success and -1 on failure. */
+typedef int (*cache_writeback_t)(int disk_num, int block_num, const uint8_t *buf);
+
+/* Told what became of a block inserted with cache_insert_prefetch: |used| is
+ * true on its first lookup and false if it is evicted without one. */
+typedef void (*cache_prefetch_hook_t)(int disk_num, int block_num, bool used);
+
 /* Returns 1 on success and -1 on failure. Should allocate a space for
  * |num_entries| cache entries, each of type cache_entry_t. Calling it again
  * without first calling cache_destroy (see below) should fail. */
 int cache_create(int num_entries);
 
+/* Same as cache_create, but entries are evicted according to |policy|
+ * instead of least recently used first. */
+int cache_create_with_policy(int num_entries, cache_policy_t policy);
+
+/* Returns the short name of |policy| ("lru", "clock", "2q" or "arc"), or NULL
+ * for an unknown policy. */
+const char *cache_policy_name(cache_policy_t policy);
+
 /* Returns 1 on success and -1 on failure. Frees the space allocated by
- * cache_create function above. */
+ * cache_create function above, after handing the dirty blocks of a
+ * write-back cache to the write-back function; if any of them could not be
+ * written back they are lost, and it returns -1. No block may be pinned any
+ * more. */
 int cache_destroy(void);
 
 /* Returns 1 on success and -1 on failure. Looks up the block located at
@@ -29,20 +69,86 @@ int cache_destroy(void);
  * block to |buf|, which must not be NULL. */
 int cache_lookup(int disk_num, int block_num, uint8_t *buf);
 
+/* Returns a pointer to the cached block at |disk_num| and |block_num|, or
+ * NULL if it is not cached; counts as a lookup. Instead of copying the
+ * block, pins its entry: a pinned entry is never evicted, so the pointer
+ * stays valid until every pin on it is released with cache_unpin. Inserts
+ * into a shard whose entries are all pinned fail. The block changes only
+ * through cache_update, which must not race with readers of a pin. */
+const uint8_t *cache_pin(int disk_num, int block_num);
+
+/* Releases a pin taken by cache_pin on the entry holding |block|. */
+void cache_unpin(const uint8_t *block);
+
 /* Returns 1 on success and -1 on failure. Inserts an entry for |disk_num| and
  * |block_num| into cache. Returns -1 if there is already an existing entry in the cache
  * with |disk_num| and |block_num|.If there cache is full, should evict least
  * recently used entry and insert the new entry. */
 int cache_insert(int disk_num, int block_num, const uint8_t *buf);
 
+/* Same as cache_insert, for a block that was read ahead of any request. The
+ * prefetch hook hears whether it gets used before it is evicted. */
+int cache_insert_prefetch(int disk_num, int block_num, const uint8_t *buf);
+
+/* Returns true if the block at |disk_num| and |block_num| is cached. Unlike
+ * cache_lookup it neither counts as a query nor refreshes the entry. */
+bool cache_contains(int disk_num, int block_num);
+
+/* Sets the function told about the fate of read-ahead blocks; NULL for none. */
+void cache_set_prefetch_hook(cache_prefetch_hook_t hook);
+
 /* If the entry with |disk_num| and |block_num| exists, updates the
  * corresponding block with data from |buf| */
 void cache_update(int disk_num, int block_num, const uint8_t *buf);
 
+/* Returns 1 on success and -1 on failure. With a non-NULL |writeback| the
+ * cache switches to write-back mode: blocks marked dirty are only handed to
+ * |writeback| when they are evicted or flushed. Passing NULL flushes any dirty
+ * blocks and returns to write-through mode. */
+int cache_set_write_back(cache_writeback_t writeback);
+
+/* Returns 1 if the entry with |disk_num| and |block_num| exists and the cache
+ * is in write-back mode, in which case the entry is now dirty, and -1
+ * otherwise. */
+int cache_mark_dirty(int disk_num, int block_num);
+
+/* Returns 1 on success and -1 on failure. Hands every dirty block to the
+ * write-back function in (disk_num, block_num) order, so runs of adjacent
+ * blocks reach the disks without seeks in between, and marks them clean. */
+int cache_flush(void);
+
+/* Returns 1 on success and -1 on failure. Gives the cache a second level of
+ * |num_entries| blocks, at most L2CACHE_MAX_ENTRIES, in a memory-mapped
+ * file at |path| (see l2cache.h), or with a NULL |path| takes it away; fails
+ * while the cache exists. The blocks the cache evicts go there, once they
+ * are clean, and a block the cache misses is looked for there before it is
+ * read from the disks, moving back into the cache if it is found. */
+int cache_set_l2(const char *path, int num_entries);
+
+/* Returns 1 on success and -1 on failure. Makes the cache persistent across
+ * restarts, or with a NULL |path| stops it being so; fails while the cache
+ * exists. cache_create then loads the snapshot at |path| if one was saved
+ * with the same |generation|, and removes it otherwise; cache_save_snapshot
+ * saves the contents of the cache and their recency order to it, which
+ * mdadm_unmount does once the disks are unmounted. Bump |generation|
+ * whenever the disks may have changed since the snapshot was saved, or its
+ * blocks would come back stale. */
+int cache_set_snapshot(const char *path, uint64_t generation);
+
+/* Returns 1 on success and -1 on failure. Saves the clean blocks of the
+ * cache to the snapshot file set with cache_set_snapshot, least recently
+ * used first. Does nothing without a snapshot file. */
+int cache_save_snapshot(void);
+
+/* Removes the snapshot file set with cache_set_snapshot, e.g. once the
+ * disks are mounted and may change behind it, as mdadm_mount does. */
+void cache_discard_snapshot(void);
+
 /* Returns true if cache is enabled and false if not. */
 bool cache_enabled(void);
 
-/* Prints the hit rate of the cache. */
+/* Prints the hit rate of the cache, and that of its second level over the
+ * lookups the cache missed. */
 void cache_print_hit_rate(void);
 
 #endif
@@ -0,0 +1,227 @@
+#include "l2cache.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the blocks live in the mapped file, one per slot; the index finds the slot of a block through hash chains and keeps
+// the slots in use on a list from the most to the least recently inserted one, the free slots on a list of their own
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t *blocks = NULL;
+static size_t mapped_size = 0;
+
+static uint32_t *keys;  // of the block in each slot in use
+static int *hash_next;  // the next slot in the same bucket, or on the free list; -1 ends either
+static int *buckets;    // the first slot in each bucket
+static int bucket_bits; // there are 1 << bucket_bits buckets
+static int *newer;      // the neighbours of each slot in use on the list, -1 at its ends
+static int *older;
+static int newest = -1;
+static int oldest = -1;
+static int free_slots = -1;
+
+// names the block at (disk_num, block_num) with a single number
+static uint32_t key_of(int disk_num, int block_num) { return (uint32_t)disk_num * JBOD_NUM_BLOCKS_PER_DISK + (uint32_t)block_num; }
+
+// the top bits of a multiplicative hash pick the bucket
+static int bucket_of(uint32_t key) { return (int)((key * 2654435761u) >> (32 - bucket_bits)); }
+
+// the slot holding the block with key, or -1 if it is not there
+static int find_slot(uint32_t key) {
+    for (int i = buckets[bucket_of(key)]; i != -1; i = hash_next[i]) {
+        if (keys[i] == key) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// takes the slot in use out of its bucket and off the list
+static void unlink_slot(int slot) {
+    int *p = &buckets[bucket_of(keys[slot])];
+    while (*p != slot) {
+        p = &hash_next[*p];
+    }
+    *p = hash_next[slot];
+
+    if (newer[slot] == -1) {
+        newest = older[slot];
+    } else {
+        older[newer[slot]] = older[slot];
+    }
+    if (older[slot] == -1) {
+        oldest = newer[slot];
+    } else {
+        newer[older[slot]] = newer[slot];
+    }
+}
+
+// puts the slot, which holds the block with key now, into its bucket and at the head of the list
+static void link_slot(int slot, uint32_t key) {
+    int b = bucket_of(key);
+
+    keys[slot] = key;
+    hash_next[slot] = buckets[b];
+    buckets[b] = slot;
+
+    newer[slot] = -1;
+    older[slot] = newest;
+    if (newest == -1) {
+        oldest = slot;
+    } else {
+        newer[newest] = slot;
+    }
+    newest = slot;
+}
+
+static void release_slot(int slot) {
+    hash_next[slot] = free_slots;
+    free_slots = slot;
+}
+
+static void free_index(void) {
+    free(keys);
+    free(hash_next);
+    free(buckets);
+    free(newer);
+    free(older);
+    keys = NULL;
+    hash_next = NULL;
+    buckets = NULL;
+    newer = NULL;
+    older = NULL;
+}
+
+int l2cache_create(const char *path, int num_entries) {
+    struct stat st;
+
+    if (blocks != NULL || path == NULL || num_entries < 1 || num_entries > L2CACHE_MAX_ENTRIES) {
+        return -1;
+    }
+
+    // the file only ever holds what this process puts into it, so its size is simply set
+    size_t bytes = (size_t)num_entries * JBOD_BLOCK_SIZE;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fstat(fd, &st) == -1 || ((size_t)st.st_size != bytes && ftruncate(fd, bytes) == -1)) {
+        close(fd);
+        return -1;
+    }
+    uint8_t *map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    // keep the load factor at or below one half so hash chains stay short
+    bucket_bits = 1;
+    while ((1 << bucket_bits) < 2 * num_entries) {
+        bucket_bits++;
+    }
+    keys = malloc(num_entries * sizeof(uint32_t));
+    hash_next = malloc(num_entries * sizeof(int));
+    buckets = malloc(((size_t)1 << bucket_bits) * sizeof(int));
+    newer = malloc(num_entries * sizeof(int));
+    older = malloc(num_entries * sizeof(int));
+    if (keys == NULL || hash_next == NULL || buckets == NULL || newer == NULL || older == NULL) {
+        free_index();
+        munmap(map, bytes);
+        return -1;
+    }
+    for (int i = 0; i < 1 << bucket_bits; i++) {
+        buckets[i] = -1;
+    }
+    free_slots = -1;
+    for (int i = num_entries - 1; i >= 0; i--) {
+        release_slot(i);
+    }
+    newest = -1;
+    oldest = -1;
+
+    blocks = map;
+    mapped_size = bytes;
+    return 1;
+}
+
+void l2cache_destroy(void) {
+    if (blocks == NULL) {
+        return;
+    }
+    munmap(blocks, mapped_size);
+    free_index();
+    blocks = NULL;
+    mapped_size = 0;
+}
+
+bool l2cache_enabled(void) { return blocks != NULL; }
+
+int l2cache_insert(int disk_num, int block_num, const uint8_t *buf) {
+    if (blocks == NULL || buf == NULL) {
+        return -1;
+    }
+
+    uint32_t key = key_of(disk_num, block_num);
+    pthread_mutex_lock(&lock);
+
+    // a block inserted again counts as the newest one; otherwise take a free slot or drop the oldest block
+    int slot = find_slot(key);
+    if (slot == -1 && free_slots != -1) {
+        slot = free_slots;
+        free_slots = hash_next[slot];
+    } else if (slot == -1) {
+        slot = oldest;
+        unlink_slot(slot);
+    } else {
+        unlink_slot(slot);
+    }
+    memcpy(blocks + (size_t)slot * JBOD_BLOCK_SIZE, buf, JBOD_BLOCK_SIZE);
+    link_slot(slot, key);
+    pthread_mutex_unlock(&lock);
+    return 1;
+}
+
+int l2cache_take(int disk_num, int block_num, uint8_t *buf) {
+    if (blocks == NULL || buf == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&lock);
+    int slot = find_slot(key_of(disk_num, block_num));
+    if (slot != -1) {
+        memcpy(buf, blocks + (size_t)slot * JBOD_BLOCK_SIZE, JBOD_BLOCK_SIZE);
+        unlink_slot(slot);
+        release_slot(slot);
+    }
+    pthread_mutex_unlock(&lock);
+    return slot == -1 ? -1 : 1;
+}
+
+void l2cache_remove(int disk_num, int block_num) {
+    if (blocks == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    int slot = find_slot(key_of(disk_num, block_num));
+    if (slot != -1) {
+        unlink_slot(slot);
+        release_slot(slot);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+bool l2cache_contains(int disk_num, int block_num) {
+    if (blocks == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&lock);
+    bool found = find_slot(key_of(disk_num, block_num)) != -1;
+    pthread_mutex_unlock(&lock);
+    return found;
+}
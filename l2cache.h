@@ -0,0 +1,45 @@
+#ifndef L2CACHE_H_
+#define L2CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "jbod.h"
+
+/* The second level of the cache: the blocks the cache evicts, kept in a
+ * file on local storage that is mapped into memory, with an index of its
+ * own in memory. It holds no block the cache holds too, so a block moves
+ * back and forth between the levels, and it only ever holds clean blocks;
+ * once full it drops the block that was evicted into it the longest ago.
+ * Every function may be called from several threads at once, except
+ * creating and destroying it. */
+#define L2CACHE_MAX_ENTRIES (1 << 20)
+#define L2CACHE_DEFAULT_FILE "l2cache.img"
+
+/* Returns 1 on success and -1 on failure. Maps |num_entries| blocks of the
+ * file at |path|, which is created or resized as needed; whatever it held
+ * before is forgotten. Fails if the second level exists already. */
+int l2cache_create(const char *path, int num_entries);
+
+/* Unmaps the file and frees the index; the file stays behind. */
+void l2cache_destroy(void);
+
+/* Returns true if the second level exists and false if not. */
+bool l2cache_enabled(void);
+
+/* Returns 1 on success and -1 on failure. Keeps a copy of the block at
+ * |disk_num| and |block_num|, replacing the copy it held of it. */
+int l2cache_insert(int disk_num, int block_num, const uint8_t *buf);
+
+/* Returns 1 if the block at |disk_num| and |block_num| was there, in which
+ * case it is copied to |buf| and dropped, and -1 otherwise. */
+int l2cache_take(int disk_num, int block_num, uint8_t *buf);
+
+/* Drops the block at |disk_num| and |block_num|, e.g. once the cache holds
+ * a newer version of it. */
+void l2cache_remove(int disk_num, int block_num);
+
+/* Returns true if the block at |disk_num| and |block_num| is there. */
+bool l2cache_contains(int disk_num, int block_num);
+
+#endif
@@ -1,8 +1,14 @@
 #include "mdadm.h"
 #include "jbod.h"
 #include "net.h"
+#include "prefetch.h"
+#include "stats.h"
 #include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 uint32_t encode_op(int cmd, int disk_num, int reserved, int block_num) {
@@ -15,23 +21,219 @@ uint32_t encode_op(int cmd, int disk_num, int reserved, int block_num) {
 // mount = 0 -> unmounted
 int mount = 0;
 
-int mdadm_mount(void) {
+typedef struct io_job io_job_t;
+typedef struct io_request io_request_t;
 
-    // check if already mounted
-    if (mount == 1) {
+// a way of talking to JBOD; while the workers run, each disk has a channel of its own with a connection and a worker
+// serving the sub-requests queued on it, otherwise every request goes through the main channel and the pool of
+// connections opened by jbod_connect_pool
+typedef struct {
+    pthread_mutex_t lock; // held while queuing operations on the connections or flushing them
+    jbod_conn_t *conn;    // NULL for the main channel, which routes each disk to a connection of the pool
+    bool failed;          // a write-back queued on the channel failed since the last flush
+
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queue_cond;
+    io_job_t *queue_head;
+    io_job_t *queue_tail;
+    bool stop;
+    pthread_t worker;
+} io_channel_t;
+
+static io_channel_t main_channel = {.lock = PTHREAD_MUTEX_INITIALIZER};
+static io_channel_t channels[JBOD_NUM_DISKS];
+static bool workers_running = false;
+
+// the channel that carries the operations on disk_num
+static io_channel_t *channel_for(int disk_num) { return workers_running ? &channels[disk_num] : &main_channel; }
+
+// the connection ch talks to JBOD over about disk_num
+static jbod_conn_t *conn_of(io_channel_t *ch, int disk_num) { return ch->conn != NULL ? ch->conn : jbod_route(disk_num); }
+
+// sends everything queued on the connections of ch and waits until all of it is answered
+static int flush_conns(io_channel_t *ch) { return ch->conn != NULL ? jbod_conn_flush(ch->conn) : jbod_pool_flush(); }
+
+// how the disks are reached: the network backend queues operations on the connections of net.c and learns how they
+// went once they are answered, the local one runs them on the spot with the jbod_operation of this process
+typedef struct {
+    int (*num_servers)(void);
+    int (*operation)(int server, uint32_t op, uint8_t *block); // runs one operation once everything queued is done
+    int (*submit_block)(io_channel_t *ch, int cmd, int disk_num, int block_num, uint8_t *block, int flags, jbod_callback_t done, void *arg);
+    int (*flush)(io_channel_t *ch); // waits until everything submitted on ch is done
+    int (*poll)(void);              // waits until something submitted is done
+    int (*read_cost)(io_channel_t *ch, int disk_num, int block_num); // how long a read submitted on ch would take
+} backend_t;
+
+// the connection of disk_num talks to its server, which knows it by its number among the disks of that server
+static int net_submit_block(io_channel_t *ch, int cmd, int disk_num, int block_num, uint8_t *block, int flags, jbod_callback_t done, void *arg) {
+    return jbod_conn_submit_block(conn_of(ch, disk_num), cmd, disk_num % JBOD_NUM_DISKS, block_num, block, flags, done, arg);
+}
+
+static int net_poll(void) { return jbod_poll(-1); }
+
+// a read waits for everything outstanding on its connection, then for the seeks it needs; a seek costs less than an
+// operation in the queue, as it carries no block
+static int net_read_cost(io_channel_t *ch, int disk_num, int block_num) {
+    jbod_conn_t *conn = conn_of(ch, disk_num);
+    return jbod_conn_pending(conn) * 3 + jbod_conn_seeks_needed(conn, disk_num % JBOD_NUM_DISKS, block_num);
+}
+
+// jbod_operation keeps a single head and is not thread safe, so the local backend runs one operation at a time and
+// keeps track of the head itself to leave out redundant seeks, as net.c does for each connection
+static pthread_mutex_t local_lock = PTHREAD_MUTEX_INITIALIZER;
+static int local_disk = -1;
+static int local_block = -1;
+static atomic_ulong local_seeks_saved;
+
+// runs op with the local lock held, counting it like net.c counts what it sends
+static int local_run(uint32_t op, uint8_t *block) {
+    uint64_t start = stats_now();
+    int rc = jbod_operation(op, block);
+
+    stats_count_command(op >> 26);
+    stats_record(STATS_JBOD_LATENCY, stats_now() - start);
+    if (rc == -1) {
+        stats_add(STATS_JBOD_FAILURES, 1);
+    }
+    return rc;
+}
+
+// jbod_operation has the disks of a single server
+static int local_num_servers(void) { return 1; }
+
+static int local_operation(int server, uint32_t op, uint8_t *block) {
+    pthread_mutex_lock(&local_lock);
+    int rc = local_run(op, block);
+
+    // mounts, unmounts and signatures leave the head wherever they like
+    local_disk = -1;
+    local_block = -1;
+    pthread_mutex_unlock(&local_lock);
+    return rc;
+}
+
+static int local_submit_block(io_channel_t *ch, int cmd, int disk_num, int block_num, uint8_t *block, int flags, jbod_callback_t done, void *arg) {
+    bool ok = true;
+
+    pthread_mutex_lock(&local_lock);
+    if (local_disk == disk_num) {
+        local_seeks_saved++;
+    } else {
+        ok = local_run(encode_op(JBOD_SEEK_TO_DISK, disk_num, 0, 0), NULL) == 0;
+        local_disk = ok ? disk_num : -1;
+        local_block = ok ? 0 : -1;
+    }
+
+    if (ok && local_block == block_num) {
+        local_seeks_saved++;
+    } else if (ok) {
+        ok = local_run(encode_op(JBOD_SEEK_TO_BLOCK, 0, 0, block_num), NULL) == 0;
+        local_block = ok ? block_num : -1;
+    }
+
+    // JBOD moves the head to the next block afterwards
+    if (ok) {
+        ok = local_run(encode_op(cmd, 0, 0, 0), block) == 0;
+        local_block = ok ? local_block + 1 : -1;
+    }
+    pthread_mutex_unlock(&local_lock);
+
+    if (done != NULL) {
+        done(arg, ok);
+    }
+    return 0;
+}
+
+// everything was done as it was submitted
+static int local_flush(io_channel_t *ch) { return 0; }
+
+static int local_poll(void) { return 0; }
+
+// nothing is ever outstanding, so only the seeks count
+static int local_read_cost(io_channel_t *ch, int disk_num, int block_num) {
+    pthread_mutex_lock(&local_lock);
+    int cur_block = local_disk == disk_num ? local_block : 0;
+    int seeks = (local_disk != disk_num) + (cur_block != block_num);
+    pthread_mutex_unlock(&local_lock);
+    return seeks;
+}
+
+static const backend_t backends[MDADM_NUM_BACKENDS] = {
+    [MDADM_BACKEND_NETWORK] = {jbod_num_servers, jbod_server_operation, net_submit_block, flush_conns, net_poll, net_read_cost},
+    [MDADM_BACKEND_LOCAL] = {local_num_servers, local_operation, local_submit_block, local_flush, local_poll, local_read_cost},
+};
+
+// the backend the disks are mounted through, or are going to be
+static const backend_t *backend = &backends[MDADM_BACKEND_NETWORK];
+
+// the servers the linear device spans while mounted, one after the other, the disks they add up to, and those the
+// linear address space is laid out over: all of them, or for a mirrored layout the first half, which the second half
+// holds a copy of
+static int num_servers = 1;
+static int num_disks = JBOD_NUM_DISKS;
+static int data_disks = JBOD_NUM_DISKS;
+
+// how the linear address space is laid out over the disks, and for a striped layout the blocks of a stripe unit
+static mdadm_layout_t layout = MDADM_LAYOUT_LINEAR;
+static int stripe_blocks = JBOD_NUM_BLOCKS_PER_DISK;
+
+// the disk that holds the copy of disk_num in a mirrored layout: the one as far into the second half of the disks,
+// which for two servers is the same disk of the other server
+static int mirror_of(int disk_num) { return disk_num + data_disks; }
+
+int mdadm_num_disks(void) { return num_disks; }
+
+int mdadm_set_layout(mdadm_layout_t which, int stripe_unit) {
+    if (mount == 1 || which < 0 || which >= MDADM_NUM_LAYOUTS) {
         return -1;
     }
+    if (which == MDADM_LAYOUT_STRIPED && (stripe_unit <= 0 || stripe_unit % JBOD_BLOCK_SIZE != 0 || JBOD_DISK_SIZE % stripe_unit != 0)) {
+        return -1;
+    }
+    layout = which;
+    stripe_blocks = which == MDADM_LAYOUT_STRIPED ? stripe_unit / JBOD_BLOCK_SIZE : JBOD_NUM_BLOCKS_PER_DISK;
+    return 1;
+}
 
-    // if not mounted, we need to do the JBOD operation
+int mdadm_sign_block(int disk_num, int block_num, uint8_t *block) {
+    if (disk_num < 0 || disk_num >= num_disks || block_num < 0 || block_num >= JBOD_NUM_BLOCKS_PER_DISK) {
+        return -1;
+    }
+    uint32_t op = encode_op(JBOD_SIGN_BLOCK, disk_num % JBOD_NUM_DISKS, 0, block_num);
+    return backend->operation(disk_num / JBOD_NUM_DISKS, op, block) == 0 ? 1 : -1;
+}
+
+int mdadm_mount(void) { return mdadm_mount_with_backend(MDADM_BACKEND_NETWORK); }
+
+int mdadm_mount_with_backend(mdadm_backend_t which) {
+
+    // check if already mounted; the workers only have connections to a single server
+    if (mount == 1 || which < 0 || which >= MDADM_NUM_BACKENDS || (workers_running && backends[which].num_servers() > 1)) {
+        return -1;
+    }
+
+    // if not mounted, we need to do the JBOD operation on every server, and undo it if any of them fails
     else {
-        uint32_t op = encode_op(JBOD_MOUNT, 0, 0, 0);
-        int rc = jbod_client_operation(op, NULL);
+        backend = &backends[which];
+        num_servers = backend->num_servers();
+        num_disks = num_servers * JBOD_NUM_DISKS;
+        data_disks = layout == MDADM_LAYOUT_MIRRORED ? num_disks / 2 : num_disks;
+        prefetch_set_layout(layout, stripe_blocks);
+        prefetch_reset();
 
-        if (rc == 0) {
-            mount = 1;
-            return 1;
+        for (int i = 0; i < num_servers; i++) {
+            if (backend->operation(i, encode_op(JBOD_MOUNT, 0, 0, 0), NULL) == -1) {
+                while (i-- > 0) {
+                    backend->operation(i, encode_op(JBOD_UNMOUNT, 0, 0, 0), NULL);
+                }
+                return -1;
+            }
         }
-        return -1;
+        mount = 1;
+
+        // the disks may change from now on, which leaves a saved snapshot of the cache stale
+        cache_discard_snapshot();
+        return 1;
     };
 }
 
@@ -42,164 +244,1033 @@ int mdadm_unmount(void) {
         return -1;
     }
 
-    // function unmounts a mounted bundle of disks
+    // function unmounts a mounted bundle of disks, once the requests in flight are done and the dirty blocks of a
+    // write-back cache are on them
     else {
-        uint32_t op = encode_op(JBOD_UNMOUNT, 0, 0, 0);
-        int rc = jbod_client_operation(op, NULL);
+        if (mdadm_flush() == -1) {
+            return -1;
+        }
+
+        // every server is unmounted even if one of them fails to be
+        int rc = 0;
+        for (int i = 0; i < num_servers; i++) {
+            if (backend->operation(i, encode_op(JBOD_UNMOUNT, 0, 0, 0), NULL) == -1) {
+                rc = -1;
+            }
+        }
 
         if (rc == 0) {
             mount = 0;
+
+            // the cache and the disks agree until the next mount, so the cache may outlive us
+            if (cache_enabled()) {
+                cache_save_snapshot();
+            }
             return 1;
         }
         return -1;
     };
 }
 
-// this function seeks to the specified disk and block number using jbod_client_operation
-void seek(int disk_number, int block_number) {
-    jbod_client_operation(encode_op(JBOD_SEEK_TO_DISK, disk_number, 0, 0), NULL);   // seek to disk_num
-    jbod_client_operation(encode_op(JBOD_SEEK_TO_BLOCK, 0, 0, block_number), NULL); // seek to block_num
-};
-
-// translate a given linear address into disk number, block number, and offset within that block
+// translate a given linear address into disk number, block number, and offset within that block; a striped layout
+// deals the stripe units out to the disks in turn, so unit n goes to disk n % data_disks, row n / data_disks, and a
+// mirrored one maps onto the first half of the disks
 void translate_address(uint32_t linear_addr, int *disk_num, int *block_num, int *offset) {
+    if (layout == MDADM_LAYOUT_STRIPED) {
+        uint32_t linear_block = linear_addr / JBOD_BLOCK_SIZE;
+        uint32_t unit = linear_block / stripe_blocks;
+        *disk_num = unit % data_disks;
+        *block_num = (unit / data_disks) * stripe_blocks + linear_block % stripe_blocks;
+        *offset = linear_addr % JBOD_BLOCK_SIZE;
+        return;
+    }
     *disk_num = linear_addr / JBOD_DISK_SIZE;
     *block_num = (linear_addr % JBOD_DISK_SIZE) / JBOD_BLOCK_SIZE;
     *offset = (linear_addr % JBOD_DISK_SIZE) % JBOD_BLOCK_SIZE;
 }
 
-int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf) {
-    uint32_t end_of_the_linear_address_space = 1048570;
+// most blocks a request can touch without allocating room for them; larger requests get theirs from the heap
+#define INLINE_IO_BLOCKS 5
+
+// the bytes of one extent of a request that fall into a single block
+typedef struct {
+    uint32_t linear_block; // the block in the linear address space
+    int seq;               // position among the pieces of the request, so overlapping writes stay in order
+    int offset;            // first byte of the block covered by the piece
+    int length;            // number of bytes of the block covered by the piece
+    uint8_t *buf;          // where the bytes go to, or come from for a write
+} block_piece_t;
+
+// a block a request touches, with the pieces of the request that fall into it
+typedef struct {
+    int disk_num;
+    int block_num;
+    block_piece_t *pieces;
+    int num_pieces;
+    bool cached;           // whether the block contents came from the cache
+    const uint8_t *pinned; // for a read, the cached block it copies from until the job stores it
+} block_span_t;
+
+// the number of blocks the extent [addr, addr + len) touches
+static int blocks_touched(uint32_t addr, uint32_t len) { return len == 0 ? 0 : (addr + len - 1) / JBOD_BLOCK_SIZE - addr / JBOD_BLOCK_SIZE + 1; }
+
+// splits the extent [addr, addr + len) with its buffer into per-block pieces numbered from seq on; returns how many
+static int split_extent(uint32_t addr, uint32_t len, uint8_t *buf, int seq, block_piece_t *pieces) {
+    int count = 0;
+    uint32_t current_address = addr;
+
+    while (current_address < addr + len) {
+        block_piece_t *piece = &pieces[count++];
+        piece->linear_block = current_address / JBOD_BLOCK_SIZE;
+        piece->seq = seq++;
+        piece->offset = current_address % JBOD_BLOCK_SIZE;
+        piece->length = JBOD_BLOCK_SIZE - piece->offset;
+        if (piece->length > addr + len - current_address) {
+            piece->length = addr + len - current_address;
+        }
+        piece->buf = buf + (current_address - addr);
+        current_address += piece->length;
+    }
+    return count;
+}
+
+// orders pieces by block, which in the linear layout is by disk and then block, and pieces of the same block the way
+// the extents came
+static int compare_pieces(const void *a, const void *b) {
+    const block_piece_t *x = a;
+    const block_piece_t *y = b;
+
+    if (x->linear_block != y->linear_block) {
+        return x->linear_block < y->linear_block ? -1 : 1;
+    }
+    return x->seq - y->seq;
+}
+
+// sorts the pieces unless they are in order already, as they are for a single extent; returns how many blocks they
+// touch
+static int sort_pieces(block_piece_t *pieces, int count) {
+    int num_blocks = count > 0;
+
+    for (int i = 1; i < count; i++) {
+        if (compare_pieces(&pieces[i - 1], &pieces[i]) > 0) {
+            qsort(pieces, count, sizeof(*pieces), compare_pieces);
+            break;
+        }
+    }
+    for (int i = 1; i < count; i++) {
+        num_blocks += pieces[i].linear_block != pieces[i - 1].linear_block;
+    }
+    return num_blocks;
+}
 
-    // checks for failures from read_invalid_parameters()
-    if ((len > 1024) || (buf == NULL && len > 0) || ((addr + len) > end_of_the_linear_address_space) || (mount == 0)) {
+// groups the sorted pieces into one span per block, so every block is fetched and stored once however many extents
+// touch it; returns the number of spans
+static int merge_pieces(block_piece_t *pieces, int count, block_span_t *spans) {
+    int num_spans = 0;
+    int offset;
+
+    for (int i = 0; i < count; i++) {
+        if (i == 0 || pieces[i].linear_block != pieces[i - 1].linear_block) {
+            block_span_t *span = &spans[num_spans++];
+            translate_address(pieces[i].linear_block * JBOD_BLOCK_SIZE, &span->disk_num, &span->block_num, &offset);
+            span->pieces = &pieces[i];
+            span->num_pieces = 0;
+            span->cached = false;
+            span->pinned = NULL;
+        }
+        spans[num_spans - 1].num_pieces++;
+    }
+    return num_spans;
+}
+
+// orders spans by disk and then block, which the linear layout gives them already
+static int compare_spans(const void *a, const void *b) {
+    const block_span_t *x = a;
+    const block_span_t *y = b;
+
+    if (x->disk_num != y->disk_num) {
+        return x->disk_num - y->disk_num;
+    }
+    return x->block_num - y->block_num;
+}
+
+// blocks read ahead of a sequential stream; they go into the cache once the reads queued for them are answered
+typedef struct {
+    int disk_num;
+    int first_block;
+    int count;
+    bool queued[PREFETCH_MAX_WINDOW];
+    uint8_t blocks[PREFETCH_MAX_WINDOW][JBOD_BLOCK_SIZE];
+} read_ahead_t;
+
+// how far a sub-request got: it queues the reads of the blocks it needs, then stores them, which for a write means
+// queuing the writes of the merged blocks, and is done once those are answered
+typedef enum { JOB_FETCH, JOB_STORE, JOB_FINISH, JOB_DONE } job_stage_t;
+
+// a sub-request: the spans of a request that fall on one disk, or all of them when no workers run
+struct io_job {
+    io_request_t *req;
+    io_channel_t *ch;
+    bool write;
+    block_span_t *spans;
+    int count;
+    uint8_t (*blocks)[JBOD_BLOCK_SIZE];
+    read_ahead_t *ahead;
+    job_stage_t stage;
+    atomic_int outstanding; // operations queued and not answered yet
+    atomic_bool failed;
+    io_job_t *next; // in the queue of a worker
+};
+
+// a request from mdadm_submit, or one that mdadm_read, mdadm_write, mdadm_readv or mdadm_writev waits for
+struct io_request {
+    mdadm_io_t io;
+    const mdadm_extent_t *extents; // what the request covers: the extent of io unless it is a vectored one
+    int num_extents;
+    mdadm_extent_t extent;
+    int total; // bytes across the extents
+    block_piece_t *pieces;
+    block_span_t *spans; // one per block the request touches, and a copy of each block
+    uint8_t (*blocks)[JBOD_BLOCK_SIZE];
+    block_piece_t inline_pieces[INLINE_IO_BLOCKS];
+    block_span_t inline_spans[INLINE_IO_BLOCKS];
+    uint8_t inline_blocks[INLINE_IO_BLOCKS][JBOD_BLOCK_SIZE];
+    read_ahead_t ahead;
+    io_job_t jobs[JBOD_NUM_DISKS];
+    int num_jobs;
+    int pending;      // jobs not done yet
+    int first_block;  // first and last linear block the request touches, so overlapping requests stay in order
+    int last_block;
+    bool started;     // without workers: its job was allowed to start
+    bool waited;      // a blocking call waits for it, so it does not go to mdadm_reap
+    bool done;
+    int rc;
+    uint64_t start_ns; // when it was started, for its latency
+    io_request_t *next; // in the list of requests in flight or of completed ones
+};
+
+// told that an operation of a job was answered; runs with the lock of the job's channel held
+static void op_done(void *arg, bool ok) {
+    io_job_t *job = arg;
+
+    if (!ok) {
+        job->failed = true;
+    }
+    job->outstanding--;
+}
+
+// told that a write-back was answered; a failure is reported by the next flush of the channel
+static void write_back_done(void *arg, bool ok) {
+    io_channel_t *ch = arg;
+
+    if (!ok) {
+        ch->failed = true;
+    }
+}
+
+// queues a read or write of the given block on ch for job, or as a write-back if job is NULL, after whatever seeks
+// it needs. Any thread may queue on any channel, e.g. to write back a block evicted from the cache. A job keeps its
+// blocks until it is done, so they go out without a copy; a write-back is copied, as the cache reuses the entry
+static int queue_block_io(io_channel_t *ch, int cmd, int disk_num, int block_num, uint8_t *block, io_job_t *job) {
+    int rc;
+
+    pthread_mutex_lock(&ch->lock);
+    if (job == NULL) {
+        rc = backend->submit_block(ch, cmd, disk_num, block_num, block, 0, write_back_done, ch);
+    } else {
+        job->outstanding++;
+        rc = backend->submit_block(ch, cmd, disk_num, block_num, block, JBOD_BORROW_BLOCK, op_done, job);
+        if (rc == -1) {
+            job->outstanding--;
+        }
+    }
+    pthread_mutex_unlock(&ch->lock);
+    return rc;
+}
+
+// queues writes of the given block to disk_num on ch, and in a mirrored layout to its copy as well, so both go out in
+// the same batch
+static int queue_block_write(io_channel_t *ch, int disk_num, int block_num, uint8_t *block, io_job_t *job) {
+    if (queue_block_io(ch, JBOD_WRITE_BLOCK, disk_num, block_num, block, job) == -1) {
         return -1;
     }
+    if (layout == MDADM_LAYOUT_MIRRORED) {
+        return queue_block_io(ch, JBOD_WRITE_BLOCK, mirror_of(disk_num), block_num, block, job);
+    }
+    return 0;
+}
 
-    int current_address = addr;
-    int block_count = 0; // how many blocks read
-    int n = len;
-    int copy_of_len = len; // keeps track of how much data have been read
-    int disk_num, block_num, offset;
+// the disk a read of the given block of disk_num goes to on ch: in a mirrored layout, whichever copy the backend
+// expects to answer sooner, going by what is outstanding on its connection and where its head is
+static int read_disk(io_channel_t *ch, int disk_num, int block_num) {
+    if (layout != MDADM_LAYOUT_MIRRORED) {
+        return disk_num;
+    }
 
-    while (current_address < addr + len) {
+    pthread_mutex_lock(&ch->lock);
+    int mirror = mirror_of(disk_num);
+    bool use_mirror = backend->read_cost(ch, mirror, block_num) < backend->read_cost(ch, disk_num, block_num);
+    pthread_mutex_unlock(&ch->lock);
+    if (use_mirror) {
+        stats_add(STATS_MIRROR_READS, 1);
+    }
+    return use_mirror ? mirror : disk_num;
+}
+
+// sends everything queued on ch and waits until all of it is answered
+static void send_ops(io_channel_t *ch) {
+    pthread_mutex_lock(&ch->lock);
+    backend->flush(ch);
+    pthread_mutex_unlock(&ch->lock);
+}
+
+// sends the batch of ch; fails if a write-back queued on it failed since the last time
+static int flush_ops(io_channel_t *ch) {
+    int rc = 0;
+
+    pthread_mutex_lock(&ch->lock);
+    if (backend->flush(ch) == -1 || ch->failed) {
+        rc = -1;
+    }
+    ch->failed = false;
+    pthread_mutex_unlock(&ch->lock);
+    return rc;
+}
+
+// whether the pieces of the span cover its whole block, so a write can replace the block without reading it first
+static bool covers_block(const block_span_t *span) {
+    bool covered[JBOD_BLOCK_SIZE] = {false};
+    int total = 0;
+
+    if (span->num_pieces == 1) {
+        return span->pieces[0].length == JBOD_BLOCK_SIZE;
+    }
+    for (int i = 0; i < span->num_pieces; i++) {
+        for (int j = span->pieces[i].offset; j < span->pieces[i].offset + span->pieces[i].length; j++) {
+            total += !covered[j];
+            covered[j] = true;
+        }
+    }
+    return total == JBOD_BLOCK_SIZE;
+}
+
+// queues reads for the blocks that follow the job on its last disk if it continues a sequential stream of reads and
+// writes; the head is already right behind the request, so they need no seek
+static int queue_read_ahead(io_job_t *job) {
+    const block_span_t *spans = job->spans;
+    read_ahead_t *ahead = job->ahead;
+    int last = job->count - 1;
+    int first = last;
+
+    ahead->count = 0;
+    if (job->count == 0 || !prefetch_enabled()) {
+        return 0;
+    }
+
+    // the stream on the last disk starts at the first span of the request on that disk
+    while (first > 0 && spans[first - 1].disk_num == spans[last].disk_num) {
+        first--;
+    }
+    ahead->disk_num = spans[last].disk_num;
+
+    // a write that replaces its last block whole would not have read it; only one that has to is read ahead of
+    if (job->write && covers_block(&spans[last])) {
+        prefetch_record(ahead->disk_num, spans[first].block_num, spans[last].block_num);
+        return 0;
+    }
+    ahead->count = prefetch_plan(ahead->disk_num, spans[first].block_num, spans[last].block_num, &ahead->first_block);
+
+    for (int i = 0; i < ahead->count; i++) {
+        int block_num = ahead->first_block + i;
+        ahead->queued[i] = !cache_contains(ahead->disk_num, block_num);
+        if (ahead->queued[i] &&
+            queue_block_io(job->ch, JBOD_READ_BLOCK, read_disk(job->ch, ahead->disk_num, block_num), block_num, ahead->blocks[i], job) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// where the block of the i-th span of the job is read into or written from: the caller's own buffer if a single piece
+// covers the whole block, so the bytes travel between it and the network without staging, otherwise the job's copy
+static uint8_t *block_of(io_job_t *job, int i) {
+    const block_span_t *span = &job->spans[i];
+    return span->num_pieces == 1 && span->pieces[0].length == JBOD_BLOCK_SIZE ? span->pieces[0].buf : job->blocks[i];
+}
+
+// whether the job has to read the block of the span before it can do its part; a write replaces whole blocks
+static bool needs_fetch(const io_job_t *job, const block_span_t *span) { return !job->write || !covers_block(span); }
+
+// fills blocks[i] for every span the job needs to read from the cache where possible and queues reads for the rest,
+// together with the read-ahead of a sequential stream. A read pins the cached blocks instead, to copy the requested
+// bytes straight out of the cache once the job gets to store them
+static int queue_fetch(io_job_t *job) {
+    block_span_t *spans = job->spans;
+
+    for (int i = 0; i < job->count; i++) {
+        if (!needs_fetch(job, &spans[i])) {
+            continue;
+        }
+        if (!job->write) {
+            spans[i].pinned = cache_pin(spans[i].disk_num, spans[i].block_num);
+        }
+        if (spans[i].pinned != NULL || (job->write && cache_lookup(spans[i].disk_num, spans[i].block_num, job->blocks[i]) == 1)) {
+            spans[i].cached = true;
+            continue;
+        }
+        int disk_num = read_disk(job->ch, spans[i].disk_num, spans[i].block_num);
+        if (queue_block_io(job->ch, JBOD_READ_BLOCK, disk_num, spans[i].block_num, block_of(job, i), job) == -1) {
+            return -1;
+        }
+    }
+    if (job->ahead != NULL && queue_read_ahead(job) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+// copies the bytes the pieces of a span read out of its block
+static void copy_out(const block_span_t *span, const uint8_t *block) {
+    for (int i = 0; i < span->num_pieces; i++) {
+        memcpy(span->pieces[i].buf, block + span->pieces[i].offset, span->pieces[i].length);
+    }
+}
+
+// merges the bytes the pieces of a span write into its block
+static void copy_in(const block_span_t *span, uint8_t *block) {
+    for (int i = 0; i < span->num_pieces; i++) {
+        memcpy(block + span->pieces[i].offset, span->pieces[i].buf, span->pieces[i].length);
+    }
+}
+
+// lets go of the cached blocks the job pinned
+static void release_pins(io_job_t *job) {
+    for (int i = 0; i < job->count; i++) {
+        if (job->spans[i].pinned != NULL) {
+            cache_unpin(job->spans[i].pinned);
+            job->spans[i].pinned = NULL;
+        }
+    }
+}
+
+// caches the blocks the job read, then copies the requested bytes of a read into its buffers, or merges the bytes of
+// a write into the blocks, caches them and queues their writes; in write-back mode the cache holds on to them instead.
+// Evicting dirty blocks may queue writes, which go out with the next batch of the channel of their disk
+static int queue_store(io_job_t *job) {
+    block_span_t *spans = job->spans;
+    read_ahead_t *ahead = job->ahead;
+
+    // the pinned blocks go first, so the inserts below can evict them again
+    for (int i = 0; i < job->count; i++) {
+        if (spans[i].pinned != NULL) {
+            copy_out(&spans[i], spans[i].pinned);
+        }
+    }
+    release_pins(job);
+
+    // blocks read straight into the caller's buffer are filled into the cache from there
+    for (int i = 0; i < job->count; i++) {
+        if (!spans[i].cached && needs_fetch(job, &spans[i])) {
+            cache_insert(spans[i].disk_num, spans[i].block_num, block_of(job, i));
+        }
+    }
+    for (int i = 0; ahead != NULL && i < ahead->count; i++) {
+        if (ahead->queued[i]) {
+            cache_insert_prefetch(ahead->disk_num, ahead->first_block + i, ahead->blocks[i]);
+        }
+    }
+
+    for (int i = 0; i < job->count; i++) {
+        uint8_t *block = block_of(job, i);
 
-        translate_address(current_address, &disk_num, &block_num, &offset); // translate address
-        seek(disk_num, block_num);                                          // seek to correct disk num and block num
-
-        uint8_t tmp[JBOD_BLOCK_SIZE];
-        int result = cache_lookup(disk_num, block_num, buf);
-        if (result == -1) {
-            jbod_client_operation(encode_op(JBOD_READ_BLOCK, 0, 0, 0), tmp);
-            cache_insert(disk_num, block_num, buf);
-        }
-
-        // read the first block
-        if (block_count == 0) {
-            if (len + offset <= JBOD_BLOCK_SIZE) { // fits in one block
-                memcpy(buf, tmp + offset, len);
-                copy_of_len -= len;
-                current_address += len;
-            } else {
-                n = JBOD_BLOCK_SIZE - offset;
-                memcpy(buf, tmp + offset, n);
-                copy_of_len -= n;
-                current_address += n;
+        if (!job->write) {
+            if (!spans[i].cached && block == job->blocks[i]) {
+                copy_out(&spans[i], block);
             }
-            block_count = 1; // not on first block anymore
+            continue;
+        }
+        if (block == job->blocks[i]) {
+            copy_in(&spans[i], block);
         }
 
-        // read full blocks
-        else if (copy_of_len >= 256) {
-            buf += n;
-            memcpy(buf, tmp, JBOD_BLOCK_SIZE);
-            copy_of_len -= 256;
-            n = 256;
-            current_address += 256;
+        if (cache_insert(spans[i].disk_num, spans[i].block_num, block) == -1) {
+            cache_update(spans[i].disk_num, spans[i].block_num, block);
+        }
+        if (cache_mark_dirty(spans[i].disk_num, spans[i].block_num) == 1) {
+            continue;
+        }
+        if (queue_block_write(job->ch, spans[i].disk_num, spans[i].block_num, block, job) == -1) {
+            return -1;
         }
+    }
+    return 0;
+}
 
-        // read the last block
-        else {
-            memcpy(buf + n, tmp, copy_of_len);
-            current_address += copy_of_len;
+// moves the job on as far as it gets without waiting for JBOD to answer
+static void advance_job(io_job_t *job) {
+    while (job->stage != JOB_DONE && job->outstanding == 0) {
+        if (job->failed) {
+            release_pins(job);
+            job->stage = JOB_DONE;
+            break;
+        }
+        switch (job->stage) {
+        case JOB_FETCH:
+            job->stage = JOB_STORE;
+            if (queue_fetch(job) == -1) {
+                job->failed = true;
+            }
+            break;
+        case JOB_STORE:
+            job->stage = JOB_FINISH;
+            if (queue_store(job) == -1) {
+                job->failed = true;
+            }
+            break;
+        default:
+            job->stage = JOB_DONE;
+            break;
         }
     }
+}
 
-    return len;
+// what mdadm_reap hands out and how many requests are still in flight; the workers complete requests concurrently
+static pthread_mutex_t completion_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t completion_cond = PTHREAD_COND_INITIALIZER;
+static io_request_t *completed_head = NULL;
+static io_request_t *completed_tail = NULL;
+static int num_in_flight = 0;
+
+// without workers: the requests in flight in the order they were submitted
+static io_request_t *in_flight_head = NULL;
+static io_request_t *in_flight_tail = NULL;
+
+// records that the request is done and hands it to whoever waits for it
+static void complete_request(io_request_t *req, int rc) {
+    bool write = req->io.op == MDADM_OP_WRITE;
+
+    // a waited request may go away as soon as it is marked done, so count it first
+    if (rc == -1) {
+        stats_add(STATS_IO_FAILURES, 1);
+    } else {
+        stats_add(write ? STATS_WRITES : STATS_READS, 1);
+        stats_add(write ? STATS_WRITE_BYTES : STATS_READ_BYTES, rc);
+        stats_record(write ? STATS_WRITE_LATENCY : STATS_READ_LATENCY, stats_now() - req->start_ns);
+    }
+
+    pthread_mutex_lock(&completion_lock);
+    req->rc = rc;
+    req->done = true;
+    num_in_flight--;
+    if (!req->waited) {
+        req->next = NULL;
+        if (completed_tail == NULL) {
+            completed_head = req;
+        } else {
+            completed_tail->next = req;
+        }
+        completed_tail = req;
+    }
+    pthread_cond_broadcast(&completion_cond);
+    pthread_mutex_unlock(&completion_lock);
 }
 
-int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf) {
+// the result of the request once all of its jobs are done
+static int request_result(const io_request_t *req) {
+    for (int i = 0; i < req->num_jobs; i++) {
+        if (req->jobs[i].failed) {
+            return -1;
+        }
+    }
+    return req->total;
+}
 
-    uint32_t end_of_the_linear_address_space = 1048576;
+// runs a sub-request on the worker of ch, sending the batch of ch whenever the job waits for JBOD
+static void run_job(io_channel_t *ch, io_job_t *job) {
+    advance_job(job);
+    while (job->stage != JOB_DONE) {
+        send_ops(ch);
+        advance_job(job);
+    }
+
+    // push out the writes of the dirty blocks the job evicted from the cache
+    if (flush_ops(ch) == -1) {
+        job->failed = true;
+    }
+
+    // the last job of the request to finish completes it
+    io_request_t *req = job->req;
+    pthread_mutex_lock(&completion_lock);
+    bool last = --req->pending == 0;
+    pthread_mutex_unlock(&completion_lock);
+    if (last) {
+        complete_request(req, request_result(req));
+    }
+}
+
+// serves the sub-requests queued on a channel, in order, until the workers are stopped
+static void *io_worker(void *arg) {
+    io_channel_t *ch = arg;
+
+    pthread_mutex_lock(&ch->queue_lock);
+    while (true) {
+        while (ch->queue_head == NULL && !ch->stop) {
+            pthread_cond_wait(&ch->queue_cond, &ch->queue_lock);
+        }
+        if (ch->queue_head == NULL) {
+            break;
+        }
+        io_job_t *job = ch->queue_head;
+        ch->queue_head = job->next;
+        if (ch->queue_head == NULL) {
+            ch->queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&ch->queue_lock);
 
-    // checks for failures from write_invalid_parameters()
-    if ((len > 1024) || (buf == NULL && len > 0) || (addr < 0) || ((addr + len) > end_of_the_linear_address_space) || (mount == 0)) {
+        run_job(ch, job);
+
+        pthread_mutex_lock(&ch->queue_lock);
+    }
+    pthread_mutex_unlock(&ch->queue_lock);
+    return NULL;
+}
+
+// whether a request in flight before req touches any block req touches; req has to wait for it
+static bool overlaps_earlier(const io_request_t *req) {
+    for (const io_request_t *other = in_flight_head; other != req; other = other->next) {
+        if (other->first_block <= req->last_block && req->first_block <= other->last_block) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// without workers: starts the requests nothing earlier overlaps, moves every request in flight on as far as it gets
+// and completes the ones that are done
+static void progress_requests(void) {
+    io_request_t *prev = NULL;
+    io_request_t *req = in_flight_head;
+
+    while (req != NULL) {
+        io_request_t *next = req->next;
+
+        if (!req->started && !overlaps_earlier(req)) {
+            req->started = true;
+        }
+        if (req->started) {
+            advance_job(&req->jobs[0]);
+        }
+        if (!req->started || req->jobs[0].stage != JOB_DONE) {
+            prev = req;
+            req = next;
+            continue;
+        }
+
+        // unlink it before completing it: a waited request may go away as soon as it is complete
+        if (prev == NULL) {
+            in_flight_head = next;
+        } else {
+            prev->next = next;
+        }
+        if (in_flight_tail == req) {
+            in_flight_tail = prev;
+        }
+        complete_request(req, request_result(req));
+
+        // a completed request may have been all that held back a later one, so look at the list again
+        prev = NULL;
+        req = in_flight_head;
+    }
+}
+
+// waits until at least one request in flight has moved on
+static void wait_for_progress(void) {
+    if (workers_running) {
+        pthread_mutex_lock(&completion_lock);
+        int before = num_in_flight;
+        while (num_in_flight == before && num_in_flight > 0) {
+            pthread_cond_wait(&completion_cond, &completion_lock);
+        }
+        pthread_mutex_unlock(&completion_lock);
+        return;
+    }
+
+    // the event loop sends what the requests queued and waits for the answers; should it fail, wait the slow way
+    if (backend->poll() == -1) {
+        send_ops(&main_channel);
+    }
+    progress_requests();
+}
+
+// whether the request may be submitted: it has to lie within the linear address space of mounted disks
+static bool valid_request(uint32_t addr, uint32_t len, const uint8_t *buf) {
+    uint32_t end_of_the_linear_address_space = data_disks * JBOD_DISK_SIZE;
+
+    // checks for failures from read_invalid_parameters() and write_invalid_parameters(); the address is checked on its
+    // own first so addr + len cannot wrap around
+    return !((len > MDADM_MAX_IO_SIZE) || (buf == NULL && len > 0) || (addr > end_of_the_linear_address_space) ||
+             (len > end_of_the_linear_address_space - addr) || (mount == 0));
+}
+
+// room for count items of size bytes: the inline room of a request if they fit into it, or otherwise from the heap
+static void *reserve(void *inline_room, int count, size_t size) {
+    return count <= INLINE_IO_BLOCKS ? inline_room : malloc(count * size);
+}
+
+// frees a request that is done, along with the room its pieces and blocks took
+static void free_request(io_request_t *req) {
+    if (req->pieces != req->inline_pieces) {
+        free(req->pieces);
+    }
+    if (req->spans != req->inline_spans) {
+        free(req->spans);
+    }
+    if (req->blocks != req->inline_blocks) {
+        free(req->blocks);
+    }
+    free(req);
+}
+
+// cuts the extents of the request into pieces and merges them into spans, sorted by disk and block; returns the number
+// of spans, or -1 if an extent is invalid or there is not enough memory
+static int split_request(io_request_t *req) {
+    int num_pieces = 0;
+    int64_t total = 0;
+
+    if (mount == 0 || req->num_extents < 0 || (req->extents == NULL && req->num_extents > 0)) {
         return -1;
     }
+    for (int i = 0; i < req->num_extents; i++) {
+        const mdadm_extent_t *extent = &req->extents[i];
 
-    int count = 0;
-    int current_address = addr;
-    int write_length = len;
-    int copy_of_length = len;
-    int written_bytes = 0;
-    int offset;
+        if (!valid_request(extent->addr, extent->len, extent->buf)) {
+            return -1;
+        }
+        num_pieces += blocks_touched(extent->addr, extent->len);
+        total += extent->len;
+    }
+    if (total > INT_MAX) {
+        return -1;
+    }
+    req->total = total;
+
+    req->pieces = reserve(req->inline_pieces, num_pieces, sizeof(*req->pieces));
+    if (req->pieces == NULL) {
+        return -1;
+    }
+    for (int i = 0, seq = 0; i < req->num_extents; i++) {
+        const mdadm_extent_t *extent = &req->extents[i];
+        seq += split_extent(extent->addr, extent->len, extent->buf, seq, &req->pieces[seq]);
+    }
+
+    int num_blocks = sort_pieces(req->pieces, num_pieces);
+    req->spans = reserve(req->inline_spans, num_blocks, sizeof(*req->spans));
+    req->blocks = reserve(req->inline_blocks, num_blocks, sizeof(*req->blocks));
+    if (req->spans == NULL || req->blocks == NULL) {
+        return -1;
+    }
+    int num_spans = merge_pieces(req->pieces, num_pieces, req->spans);
+
+    // a striped request interleaves the disks, and comes back to each of them a stripe unit later
+    if (layout != MDADM_LAYOUT_LINEAR) {
+        qsort(req->spans, num_spans, sizeof(*req->spans), compare_spans);
+    }
+    if (num_pieces > 0) {
+        req->first_block = req->pieces[0].linear_block;
+        req->last_block = req->pieces[num_pieces - 1].linear_block;
+    }
+    return num_spans;
+}
+
+// splits the request into per-disk sub-requests for the workers of their disks, or a single one for the main
+// channel if no workers run, and sets them going; invalid requests complete right away
+static void start_request(io_request_t *req) {
+    req->start_ns = stats_now();
+    req->next = NULL;
+    req->started = false;
+    req->done = false;
+    req->num_jobs = 0;
+    req->ahead.count = 0;
+    req->pieces = req->inline_pieces;
+    req->spans = req->inline_spans;
+    req->blocks = req->inline_blocks;
+    pthread_mutex_lock(&completion_lock);
+    num_in_flight++;
+    pthread_mutex_unlock(&completion_lock);
 
-    // loop that runs until all data has been written to the storage system
-    while (current_address < (addr + len)) {
-
-        offset = (current_address % JBOD_DISK_SIZE) % JBOD_BLOCK_SIZE; // set the offset number for the current address
-        uint8_t buffer[JBOD_BLOCK_SIZE];                               // set temporary buffer to hold data be written to the storage system
-
-        // First, look up the block in the cache.
-        int cache_index = cache_lookup((current_address / JBOD_DISK_SIZE), ((current_address % JBOD_DISK_SIZE) / JBOD_BLOCK_SIZE), buffer);
-
-        // If the block is not in the cache, read it from disk and insert it into the cache.
-        if (cache_index == -1) {
-            seek((current_address / JBOD_DISK_SIZE), ((current_address % JBOD_DISK_SIZE) / JBOD_BLOCK_SIZE));
-            jbod_client_operation(encode_op(JBOD_READ_BLOCK, 0, 0, 0), buffer);                               // reads the block into the temporary buffer
-            seek((current_address / JBOD_DISK_SIZE), ((current_address % JBOD_DISK_SIZE) / JBOD_BLOCK_SIZE)); // seek to the appropriate disk and block
-
-            // Insert the block into the cache.
-            cache_insert((current_address / JBOD_DISK_SIZE), ((current_address % JBOD_DISK_SIZE) / JBOD_BLOCK_SIZE), buffer);
-        }
-
-        // writes the first block
-        if (count == 0) {
-            if (len + offset <= JBOD_BLOCK_SIZE) {
-                memcpy(buffer + offset, buf, len); // copies the data from the user-supplied buffer to the appropriate location in the temporary buffer
-                jbod_client_operation(encode_op(JBOD_WRITE_BLOCK, 0, 0, 0), buffer); // writes buffer back to the block
-                written_bytes += len;                                                // update the number of bytes written
-                copy_of_length -= len;                                               // update the remaining length of data to be written
-                current_address += len;                                              // update the current address
-
-            } else {
-                write_length = JBOD_BLOCK_SIZE - offset;
-                memcpy(buffer + offset, buf, write_length); // copies the data from the user-supplied buffer to the appropriate location in the temporary buffer
-                written_bytes += write_length;
-                jbod_client_operation(encode_op(JBOD_WRITE_BLOCK, 0, 0, 0), buffer); // writes buffer back to the block
-                copy_of_length -= write_length;
-                current_address += write_length;
+    int count = split_request(req);
+    if (count == -1) {
+        complete_request(req, -1);
+        return;
+    }
+
+    // the spans are in disk order, so each disk gets at most one job
+    for (int i = 0; i < count; i++) {
+        if (req->num_jobs == 0 || (workers_running && req->spans[i].disk_num != req->spans[i - 1].disk_num)) {
+            io_job_t *job = &req->jobs[req->num_jobs++];
+
+            *job = (io_job_t){.req = req, .write = req->io.op == MDADM_OP_WRITE, .spans = &req->spans[i], .blocks = &req->blocks[i]};
+            job->ch = channel_for(req->spans[i].disk_num);
+        }
+        req->jobs[req->num_jobs - 1].count++;
+    }
+    if (req->num_jobs == 0) {
+        complete_request(req, 0);
+        return;
+    }
+    req->pending = req->num_jobs;
+
+    // a sequential stream is read ahead on the disk the request ends on; extents scattered over the disks are not one.
+    // Writes carry a stream on as well: one that does not cover the last block of a sequential run reads it first,
+    // and the next write of the run would have to read the block after that
+    if (req->num_extents == 1) {
+        req->jobs[req->num_jobs - 1].ahead = &req->ahead;
+    }
+
+    if (!workers_running) {
+        if (in_flight_tail == NULL) {
+            in_flight_head = req;
+        } else {
+            in_flight_tail->next = req;
+        }
+        in_flight_tail = req;
+        progress_requests();
+        return;
+    }
+
+    for (int i = 0; i < req->num_jobs; i++) {
+        io_channel_t *ch = req->jobs[i].ch;
+
+        pthread_mutex_lock(&ch->queue_lock);
+        if (ch->queue_tail == NULL) {
+            ch->queue_head = &req->jobs[i];
+        } else {
+            ch->queue_tail->next = &req->jobs[i];
+        }
+        ch->queue_tail = &req->jobs[i];
+        pthread_cond_signal(&ch->queue_cond);
+        pthread_mutex_unlock(&ch->queue_lock);
+    }
+}
+
+// whether the request is done; the workers complete requests concurrently
+static bool request_done(io_request_t *req) {
+    pthread_mutex_lock(&completion_lock);
+    bool done = req->done;
+    pthread_mutex_unlock(&completion_lock);
+    return done;
+}
+
+// runs a single request over the extents and waits until it is done; returns its result
+static int run_request(mdadm_op_t op, const mdadm_extent_t *extents, int count) {
+    io_request_t *req = malloc(sizeof(*req));
+    if (req == NULL) {
+        return -1;
+    }
+    req->io = (mdadm_io_t){.op = op};
+    req->extents = extents;
+    req->num_extents = count;
+    req->waited = true;
+    start_request(req);
+    while (!request_done(req)) {
+        wait_for_progress();
+    }
+
+    int rc = req->rc;
+    free_request(req);
+    return rc;
+}
+
+int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf) {
+    mdadm_extent_t extent = {.addr = addr, .len = len, .buf = buf};
+    return run_request(MDADM_OP_READ, &extent, 1);
+}
+
+int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf) {
+    mdadm_extent_t extent = {.addr = addr, .len = len, .buf = (uint8_t *)buf};
+    return run_request(MDADM_OP_WRITE, &extent, 1);
+}
+
+int mdadm_readv(const mdadm_extent_t *extents, int count) { return run_request(MDADM_OP_READ, extents, count); }
+
+int mdadm_writev(const mdadm_extent_t *extents, int count) { return run_request(MDADM_OP_WRITE, extents, count); }
+
+int mdadm_submit(const mdadm_io_t *ios, int count) {
+    for (int i = 0; i < count; i++) {
+        io_request_t *req = malloc(sizeof(*req));
+        if (req == NULL) {
+            return i > 0 ? i : -1;
+        }
+        req->io = ios[i];
+        req->extent = (mdadm_extent_t){.addr = ios[i].addr, .len = ios[i].len, .buf = ios[i].buf};
+        req->extents = &req->extent;
+        req->num_extents = 1;
+        req->waited = false;
+        start_request(req);
+    }
+    return count;
+}
+
+int mdadm_reap(mdadm_completion_t *completions, int max, int min) {
+    int n = 0;
+
+    while (n < max) {
+        pthread_mutex_lock(&completion_lock);
+        io_request_t *req = completed_head;
+        if (req != NULL) {
+            completed_head = req->next;
+            if (completed_head == NULL) {
+                completed_tail = NULL;
             }
-            count = 1;
         }
+        bool idle = num_in_flight == 0;
+        pthread_mutex_unlock(&completion_lock);
+
+        if (req != NULL) {
+            completions[n].user_data = req->io.user_data;
+            completions[n].result = req->rc;
+            n++;
+            free_request(req);
+            continue;
+        }
+
+        // nothing left to hand out: stop once there is enough or nothing more can come
+        if (n >= min || idle) {
+            break;
+        }
+        wait_for_progress();
+    }
+    return n;
+}
+
+// waits until every request in flight is done
+static void wait_for_requests(void) {
+    while (true) {
+        pthread_mutex_lock(&completion_lock);
+        bool idle = num_in_flight == 0;
+        pthread_mutex_unlock(&completion_lock);
+        if (idle) {
+            break;
+        }
+        wait_for_progress();
+    }
+}
+
+// hands a dirty block evicted or flushed from the cache to JBOD; the write goes out with the next batch of the channel
+// of its disk
+static int write_back_block(int disk_num, int block_num, const uint8_t *buf) {
+    if (mount == 0) {
+        return -1;
+    }
+    if (queue_block_write(channel_for(disk_num), disk_num, block_num, (uint8_t *)buf, NULL) == -1) {
+        return -1;
+    }
+    return 1;
+}
+
+// sends the batches of all channels
+static int flush_all(void) {
+    int rc = flush_ops(&main_channel);
+
+    for (int i = 0; workers_running && i < JBOD_NUM_DISKS; i++) {
+        if (flush_ops(&channels[i]) == -1) {
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+int mdadm_set_write_back(bool enable) {
+    if (!cache_enabled()) {
+        return -1;
+    }
+    wait_for_requests();
+    if (cache_set_write_back(enable ? write_back_block : NULL) == -1 || flush_all() == -1) {
+        return -1;
+    }
+    return 1;
+}
+
+int mdadm_flush(void) {
+    if (mount == 0) {
+        return -1;
+    }
+    wait_for_requests();
+    if (cache_enabled() && cache_flush() == -1) {
+        flush_all();
+        return -1;
+    }
+    return flush_all() == -1 ? -1 : 1;
+}
+
+// stops the workers of the first num_started channels and closes the connections of all of them
+static void stop_workers(int num_started) {
+    for (int i = 0; i < JBOD_NUM_DISKS; i++) {
+        io_channel_t *ch = &channels[i];
+
+        if (i < num_started) {
+            pthread_mutex_lock(&ch->queue_lock);
+            ch->stop = true;
+            pthread_cond_signal(&ch->queue_cond);
+            pthread_mutex_unlock(&ch->queue_lock);
+            pthread_join(ch->worker, NULL);
+        }
+        jbod_conn_close(ch->conn);
+        ch->conn = NULL;
+        pthread_mutex_destroy(&ch->lock);
+        pthread_mutex_destroy(&ch->queue_lock);
+        pthread_cond_destroy(&ch->queue_cond);
+    }
+}
+
+int mdadm_start_workers(const char *ip, uint16_t port) {
+    if (workers_running || (mount == 1 && num_servers > 1)) {
+        return -1;
+    }
+    wait_for_requests();
+
+    // every channel gets its connection before any worker starts, so a failure leaves nothing running; once one
+    // connection failed the rest are not tried, as each failure may take the server a probe timeout to show
+    bool connected = true;
+    for (int i = 0; i < JBOD_NUM_DISKS; i++) {
+        io_channel_t *ch = &channels[i];
 
-        // write extends beyond the first block
-        else if (copy_of_length >= 256) {
-            memcpy(buffer, buf + written_bytes, JBOD_BLOCK_SIZE);                // copies data from buf to buffer
-            jbod_client_operation(encode_op(JBOD_WRITE_BLOCK, 0, 0, 0), buffer); // write buffer to the block
-            copy_of_length -= 256;
-            write_length = 256;
-            written_bytes += 256;
-            current_address += 256;
+        pthread_mutex_init(&ch->lock, NULL);
+        pthread_mutex_init(&ch->queue_lock, NULL);
+        pthread_cond_init(&ch->queue_cond, NULL);
+        ch->conn = connected ? jbod_conn_open(ip, port) : NULL;
+        ch->failed = false;
+        ch->queue_head = NULL;
+        ch->queue_tail = NULL;
+        ch->stop = false;
+        if (ch->conn == NULL) {
+            connected = false;
         }
+    }
+    if (!connected) {
+        stop_workers(0);
+        return -1;
+    }
 
-        // last block
-        else {
-            memcpy(buffer + offset, buf + written_bytes, copy_of_length);
-            jbod_client_operation(encode_op(JBOD_WRITE_BLOCK, 0, 0, 0), buffer);
-            current_address += copy_of_length;
+    workers_running = true;
+    for (int i = 0; i < JBOD_NUM_DISKS; i++) {
+        if (pthread_create(&channels[i].worker, NULL, io_worker, &channels[i]) != 0) {
+            stop_workers(i);
+            workers_running = false;
+            return -1;
         }
     }
+    return 1;
+}
 
-    return len;
+void mdadm_stop_workers(void) {
+    if (!workers_running) {
+        return;
+    }
+    wait_for_requests();
+    flush_all();
+    stop_workers(JBOD_NUM_DISKS);
+    workers_running = false;
 }
+
+void mdadm_print_seeks_saved(void) { fprintf(stderr, "Seeks saved: %lu\n", jbod_seeks_saved() + local_seeks_saved); }
@@ -1,20 +1,161 @@
 #ifndef MDADM_H_
 #define MDADM_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 #include "jbod.h"
 #include "cache.h"
 
-/* Return 1 on success and -1 on failure */
+/* Ways of reaching the disks: over the network, through the connections
+ * of net.c, or in this process, by calling jbod_operation directly. */
+typedef enum {
+  MDADM_BACKEND_NETWORK,
+  MDADM_BACKEND_LOCAL,
+  MDADM_NUM_BACKENDS,
+} mdadm_backend_t;
+
+/* Return 1 on success and -1 on failure. Mounts the disks through the
+ * network backend: those of every server it is connected to, as a single
+ * linear device. */
 int mdadm_mount(void);
 
+/* Return 1 on success and -1 on failure. Mounts the disks through
+ * |backend|, which carries every operation on them until they are
+ * unmounted. */
+int mdadm_mount_with_backend(mdadm_backend_t backend);
+
+/* Returns the number of disks of the linear device: those of every server
+ * the network backend is connected to (see jbod_connect_servers), one
+ * server after the other, or those of the local backend. Set by the mount;
+ * linear addresses run up to this many times JBOD_DISK_SIZE, or half that
+ * for a mirrored layout. */
+int mdadm_num_disks(void);
+
+/* Ways of laying the linear address space out over the disks: one disk
+ * after the other; striped (RAID-0), with consecutive stripe units on
+ * consecutive disks, round-robin; or mirrored (RAID-1), one disk after the
+ * other over the first half of the disks, each of which has its copy on the
+ * disk as far into the second half. A mirrored layout writes both copies
+ * and reads from whichever copy is expected to answer sooner, and assumes
+ * the copies are the same when it is mounted. */
+typedef enum {
+  MDADM_LAYOUT_LINEAR,
+  MDADM_LAYOUT_STRIPED,
+  MDADM_LAYOUT_MIRRORED,
+  MDADM_NUM_LAYOUTS,
+} mdadm_layout_t;
+
+/* Return 1 on success and -1 on failure. Picks the layout the next mount
+ * uses; fails while mounted. The stripe unit of a striped layout is
+ * |stripe_unit| bytes, a multiple of JBOD_BLOCK_SIZE that divides
+ * JBOD_DISK_SIZE; it is ignored for the other layouts. The linear layout
+ * is the default. */
+int mdadm_set_layout(mdadm_layout_t layout, int stripe_unit);
+
+/* Return 1 on success and -1 on failure. Puts the signature of block
+ * |block_num| of disk |disk_num| into |block|, through the backend the
+ * disks are mounted with and after everything queued on it before. */
+int mdadm_sign_block(int disk_num, int block_num, uint8_t *block);
+
 /* Return 1 on success and -1 on failure */
 int mdadm_unmount(void);
 
+/* Largest request mdadm_read and mdadm_write accept: the linear address
+ * space of one server. Requests across several disks need one seek per
+ * disk. */
+#define MDADM_MAX_IO_SIZE (JBOD_NUM_DISKS * JBOD_DISK_SIZE)
+
 /* Return the number of bytes read on success, -1 on failure. */
 int mdadm_read(uint32_t addr, uint32_t len, uint8_t *buf);
 
 /* Return the number of bytes written on success, -1 on failure. */
 int mdadm_write(uint32_t addr, uint32_t len, const uint8_t *buf);
 
+/* An extent of the linear device for mdadm_readv and mdadm_writev. */
+typedef struct {
+  uint32_t addr;
+  uint32_t len;
+  uint8_t *buf;
+} mdadm_extent_t;
+
+/* Return the total number of bytes read on success, -1 on failure. Reads
+ * |count| extents as a single request: the blocks they touch are fetched
+ * in disk and block order, each one once however many extents touch it,
+ * so the whole batch needs the fewest seeks and block operations. */
+int mdadm_readv(const mdadm_extent_t *extents, int count);
+
+/* Return the total number of bytes written on success, -1 on failure.
+ * Like mdadm_readv, for writes; where extents overlap, the later one in
+ * |extents| wins. */
+int mdadm_writev(const mdadm_extent_t *extents, int count);
+
+typedef enum {
+  MDADM_OP_READ,
+  MDADM_OP_WRITE,
+} mdadm_op_t;
+
+/* A request for mdadm_submit: read or write |len| bytes at linear address
+ * |addr| into or from |buf|. |user_data| comes back with its completion. */
+typedef struct {
+  mdadm_op_t op;
+  uint32_t addr;
+  uint32_t len;
+  uint8_t *buf;
+  void *user_data;
+} mdadm_io_t;
+
+/* The completion of a request from mdadm_submit. |result| is what
+ * mdadm_read or mdadm_write would have returned for it. */
+typedef struct {
+  void *user_data;
+  int result;
+} mdadm_completion_t;
+
+/* Returns the number of requests submitted, -1 on failure. Starts |count|
+ * requests without waiting for them; their buffers must stay valid, and
+ * those of writes unchanged, until they are reaped. Requests run
+ * concurrently, except that one touching a block an earlier request in
+ * flight touches waits for that request. An invalid request completes
+ * right away with a result of -1.
+ * mdadm_read and mdadm_write are this plus waiting for the completion. */
+int mdadm_submit(const mdadm_io_t *ios, int count);
+
+/* Returns the number of completions stored in |completions|, at most
+ * |max|. Waits until at least |min| requests have completed, or until
+ * nothing is in flight any more. Without workers the waiting runs the
+ * event loop over the JBOD connection, which is what moves the requests
+ * on, so requests only progress while somebody reaps or calls another
+ * mdadm function. */
+int mdadm_reap(mdadm_completion_t *completions, int max, int min);
+
+/* Return 1 on success and -1 on failure. Switches the cache between
+ * write-back mode, where writes to cached blocks stay in the cache until
+ * they are evicted or flushed, and write-through mode. Fails when the cache
+ * is not enabled. */
+int mdadm_set_write_back(bool enable);
+
+/* Return 1 on success and -1 on failure. Waits for the requests in flight,
+ * then writes every dirty cached block to JBOD, sorted by disk and block.
+ * mdadm_unmount does this implicitly. */
+int mdadm_flush(void);
+
+/* Return 1 on success and -1 on failure. Starts one I/O worker per disk,
+ * each with a connection of its own to the JBOD server at |ip|:|port|.
+ * mdadm_read and mdadm_write then split a request into one sub-request per
+ * disk it touches, run the sub-requests on the workers of their disks in
+ * parallel and return once all of them have completed. The server must
+ * accept several connections at once and keep a separate head position for
+ * each of them. Requests must still come from one thread at a time. Fails
+ * while disks of several servers are mounted, and they cannot be mounted
+ * while the workers run. */
+int mdadm_start_workers(const char *ip, uint16_t port);
+
+/* Sends what the workers still have queued, stops them and closes their
+ * connections; requests run on the calling thread again. */
+void mdadm_stop_workers(void);
+
+/* Prints how many seek commands were skipped because the head was already
+ * at the requested disk and block. */
+void mdadm_print_seeks_saved(void);
+
 #endif
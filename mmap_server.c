@@ -0,0 +1,363 @@
+#include "mmap_server.h"
+#include "jbod.h"
+#include "net.h"
+#include "util.h"
+#include <arpa/inet.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define SERVER_ARGUMENTS "hzf:p:"
+#define USAGE                                                                     \
+  "USAGE: mmap_server [-h] [-z] [-f image-file] [-p port]\n"                      \
+  "\n"                                                                            \
+  "where:\n"                                                                      \
+  "    -h - help mode (display this message)\n"                                   \
+  "    -f - file the disks are kept in (default jbod.img)\n"                      \
+  "    -p - port to listen on (default 3333)\n"                                   \
+  "    -z - zero the disks whenever no other client has them mounted at a\n"      \
+  "         mount, as jbod_server does, instead of keeping what they held\n"      \
+  "\n"                                                                            \
+
+// a client being served: the requests it sent that were not carried out yet, the responses not sent yet, where its
+// head is and whether it mounted the disks. Every client has a head of its own, while the disks are shared
+typedef struct {
+    int sd;
+    bool mounted;
+    int cur_disk;
+    int cur_block;
+    uint8_t in[MMAP_SERVER_BUFFER_SIZE];
+    size_t in_len;
+    uint8_t out[MMAP_SERVER_BUFFER_SIZE];
+    size_t out_len;
+    size_t out_sent; // bytes of the responses that went out already
+    bool want_out;   // the event loop waits for room in the socket rather than for requests
+} client_t;
+
+// the disks, mapped from the image file, and how many clients have them mounted; they stay mounted until the last of
+// those unmounts or goes away. Operations are carried out for any client while they are mounted, as a client may
+// spread its operations over several connections and mount over only one of them
+static uint8_t *disks;
+static int num_mounted = 0;
+static bool zero_on_mount = false;
+
+// set by SIGINT and SIGTERM to shut the server down cleanly
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int sig) { stopping = 1; }
+
+// the first byte of block_num on disk_num
+static uint8_t *block_at(int disk_num, int block_num) { return disks + disk_num * JBOD_DISK_SIZE + block_num * JBOD_BLOCK_SIZE; }
+
+// gives up the mount of c, if it has one; the last client to give it up gets the disks on their way to the image,
+// which they are whatever happens, just sooner
+static bool release_mount(client_t *c) {
+    if (!c->mounted) {
+        return false;
+    }
+    c->mounted = false;
+    if (--num_mounted == 0) {
+        msync(disks, MMAP_SERVER_IMAGE_SIZE, MS_ASYNC);
+    }
+    return true;
+}
+
+// carries out op for c as jbod_operation would; returns true if it succeeded and puts the block a read or signature
+// answers with into block, setting *has_block
+static bool execute(client_t *c, uint32_t op, const uint8_t *payload, uint8_t *block, bool *has_block) {
+    int cmd = op >> 26;
+    int disk_num = (op >> 22) & 0xf;
+    int block_num = op & 0xff;
+
+    *has_block = false;
+    if (cmd == JBOD_MOUNT) {
+        // only the first client to mount starts from zeroed disks, the others join it on what it left there
+        if (c->mounted) {
+            return false;
+        }
+        if (num_mounted++ == 0 && zero_on_mount) {
+            memset(disks, 0, MMAP_SERVER_IMAGE_SIZE);
+        }
+        c->mounted = true;
+        c->cur_disk = 0;
+        c->cur_block = 0;
+        return true;
+    }
+    if (num_mounted == 0) {
+        return false;
+    }
+
+    switch (cmd) {
+    case JBOD_UNMOUNT:
+        return release_mount(c);
+    case JBOD_SEEK_TO_DISK:
+        c->cur_disk = disk_num;
+        c->cur_block = 0;
+        return true;
+    case JBOD_SEEK_TO_BLOCK:
+        c->cur_block = block_num;
+        return true;
+    case JBOD_READ_BLOCK:
+    case JBOD_WRITE_BLOCK:
+        if (c->cur_block >= JBOD_NUM_BLOCKS_PER_DISK || (cmd == JBOD_WRITE_BLOCK && payload == NULL)) {
+            return false;
+        }
+        if (cmd == JBOD_READ_BLOCK) {
+            memcpy(block, block_at(c->cur_disk, c->cur_block), JBOD_BLOCK_SIZE);
+            *has_block = true;
+        } else {
+            memcpy(block_at(c->cur_disk, c->cur_block), payload, JBOD_BLOCK_SIZE);
+        }
+
+        // JBOD moves the head to the next block afterwards
+        c->cur_block++;
+        return true;
+    case JBOD_SIGN_BLOCK:
+        memset(block, 0, JBOD_BLOCK_SIZE);
+        snprintf((char *)block, JBOD_BLOCK_SIZE, "SIG(disk,block) %2d %3d : %s\n", disk_num, block_num,
+                 sha1_sig(block_at(disk_num, block_num), JBOD_BLOCK_SIZE));
+        *has_block = true;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// carries out the complete requests at the front of the input of c and gathers their responses, as many as there is
+// room for; returns the number of request bytes consumed, or -1 if the client broke the protocol
+static ssize_t handle_requests(client_t *c) {
+    size_t used = 0;
+
+    while (c->in_len - used >= HEADER_LEN && c->out_len + MMAP_SERVER_MAX_PACKET <= MMAP_SERVER_BUFFER_SIZE) {
+        const uint8_t *request = c->in + used;
+        uint8_t *response = c->out + c->out_len;
+        uint16_t len;
+        uint32_t op;
+
+        memcpy(&len, request, sizeof(len));
+        memcpy(&op, request + 2, sizeof(op));
+        len = ntohs(len);
+        op = ntohl(op);
+        if (len != HEADER_LEN && len != MMAP_SERVER_MAX_PACKET) {
+            return -1;
+        }
+        if (c->in_len - used < len) {
+            break;
+        }
+
+        // the response echoes the op code and carries the return code and, for reads and signatures, a block
+        bool has_block;
+        bool ok = execute(c, op, len == MMAP_SERVER_MAX_PACKET ? request + HEADER_LEN : NULL, response + HEADER_LEN, &has_block);
+        uint16_t out_len = htons(has_block ? MMAP_SERVER_MAX_PACKET : HEADER_LEN);
+        uint16_t ret = htons(ok ? 0 : (uint16_t)-1);
+        uint32_t out_op = htonl(op);
+
+        memcpy(response, &out_len, sizeof(out_len));
+        memcpy(response + 2, &out_op, sizeof(out_op));
+        memcpy(response + 6, &ret, sizeof(ret));
+        c->out_len += has_block ? MMAP_SERVER_MAX_PACKET : HEADER_LEN;
+        used += len;
+    }
+    return used;
+}
+
+// sends as much of the responses gathered for c as the socket takes; returns false if the connection failed
+static bool send_responses(client_t *c) {
+    while (c->out_sent < c->out_len) {
+        ssize_t n = send(c->sd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        c->out_sent += n;
+    }
+    c->out_len = 0;
+    c->out_sent = 0;
+    return true;
+}
+
+// serves c after the event loop found its socket ready: receives what it sent with one recv, carries out every
+// complete request and sends the responses together. A client whose responses do not fit into its socket is not read
+// from until they went out, so a client that does not read cannot make the server buffer without bounds. Returns
+// false if the client should be dropped
+static bool serve(int epoll_fd, client_t *c) {
+    if (!c->want_out) {
+        ssize_t n = recv(c->sd, c->in + c->in_len, MMAP_SERVER_BUFFER_SIZE - c->in_len, MSG_DONTWAIT);
+        if (n == 0 || (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            return false;
+        }
+        c->in_len += n > 0 ? n : 0;
+    }
+
+    for (;;) {
+        if (!send_responses(c)) {
+            return false;
+        }
+        if (c->out_len > 0) {
+            break;
+        }
+        ssize_t used = handle_requests(c);
+        if (used == -1) {
+            return false;
+        }
+        if (used == 0) {
+            break;
+        }
+        memmove(c->in, c->in + used, c->in_len - used);
+        c->in_len -= used;
+    }
+
+    bool want_out = c->out_len > 0;
+    if (want_out != c->want_out) {
+        struct epoll_event ev = {.events = want_out ? EPOLLOUT : EPOLLIN, .data.ptr = c};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->sd, &ev) == -1) {
+            return false;
+        }
+        c->want_out = want_out;
+    }
+    return true;
+}
+
+// accepts every client waiting on the listener and adds it to the event loop
+static void accept_clients(int epoll_fd, int listener) {
+    int sd;
+
+    while ((sd = accept(listener, NULL, NULL)) != -1) {
+        client_t *c = calloc(1, sizeof(*c));
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+        int one = 1;
+
+        setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (c == NULL || fcntl(sd, F_SETFL, O_NONBLOCK) == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sd, &ev) == -1) {
+            free(c);
+            close(sd);
+            continue;
+        }
+        c->sd = sd;
+    }
+}
+
+// takes c out of the event loop and hangs up on it; a client that goes away while it has the disks mounted unmounts
+// them, so one that crashed does not keep them mounted for good
+static void drop_client(int epoll_fd, client_t *c) {
+    release_mount(c);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->sd, NULL);
+    close(c->sd);
+    free(c);
+}
+
+// maps the image file at path, creating it or extending it with zeros as needed
+static uint8_t *map_image(const char *path) {
+    struct stat st;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        err(1, "Cannot open image file %s", path);
+    }
+    if (st.st_size < MMAP_SERVER_IMAGE_SIZE && ftruncate(fd, MMAP_SERVER_IMAGE_SIZE) == -1) {
+        err(1, "Cannot extend image file %s", path);
+    }
+    uint8_t *image = mmap(NULL, MMAP_SERVER_IMAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (image == MAP_FAILED) {
+        err(1, "Cannot map image file %s", path);
+    }
+    close(fd);
+    return image;
+}
+
+// opens a non-blocking socket listening on the server address and port
+static int listen_on(uint16_t port) {
+    struct sockaddr_in saddr = {.sin_family = AF_INET, .sin_port = htons(port)};
+    int one = 1;
+    int sd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (sd == -1 || setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1 || inet_aton(JBOD_SERVER, &saddr.sin_addr) == 0 ||
+        bind(sd, (struct sockaddr *)&saddr, sizeof(saddr)) == -1 || listen(sd, SOMAXCONN) == -1 ||
+        fcntl(sd, F_SETFL, O_NONBLOCK) == -1) {
+        err(1, "Cannot listen on port %u", port);
+    }
+    return sd;
+}
+
+int main(int argc, char *argv[]) {
+    const char *image = MMAP_SERVER_DEFAULT_IMAGE;
+    uint16_t port = JBOD_PORT;
+    int ch;
+
+    while ((ch = getopt(argc, argv, SERVER_ARGUMENTS)) != -1) {
+        switch (ch) {
+        case 'h':
+            fprintf(stderr, USAGE);
+            return 0;
+        case 'z':
+            zero_on_mount = true;
+            break;
+        case 'f':
+            image = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return -1;
+        }
+    }
+
+    disks = map_image(image);
+    int listener = listen_on(port);
+
+    // no SA_RESTART, so a signal also gets the server out of epoll_wait
+    struct sigaction sa = {.sa_handler = stop};
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    // the listener is told apart from the clients by its lack of a client
+    int epoll_fd = epoll_create1(0);
+    struct epoll_event listen_ev = {.events = EPOLLIN, .data.ptr = NULL};
+    if (epoll_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener, &listen_ev) == -1) {
+        err(1, "Cannot set up the event loop");
+    }
+
+    // every wakeup serves each client that is ready once, so a busy client cannot hold up the others
+    while (!stopping) {
+        struct epoll_event events[MMAP_SERVER_MAX_EVENTS];
+        int n = epoll_wait(epoll_fd, events, MMAP_SERVER_MAX_EVENTS, -1);
+
+        for (int i = 0; i < n; i++) {
+            client_t *c = events[i].data.ptr;
+            if (c == NULL) {
+                accept_clients(epoll_fd, listener);
+            } else if ((events[i].events & (EPOLLERR | EPOLLHUP)) && !(events[i].events & EPOLLIN)) {
+                drop_client(epoll_fd, c);
+            } else if (!serve(epoll_fd, c)) {
+                drop_client(epoll_fd, c);
+            }
+        }
+    }
+
+    close(listener);
+    if (msync(disks, MMAP_SERVER_IMAGE_SIZE, MS_SYNC) == -1) {
+        err(1, "Cannot write image file %s", image);
+    }
+    munmap(disks, MMAP_SERVER_IMAGE_SIZE);
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef MMAP_SERVER_H_
+#define MMAP_SERVER_H_
+
+#include "jbod.h"
+#include "net.h"
+
+/* The disks live in an image file, one after the other and each one block
+ * after block, so block b of disk d is at byte
+ * d * JBOD_DISK_SIZE + b * JBOD_BLOCK_SIZE. A missing or short image is
+ * extended with zeros. */
+#define MMAP_SERVER_IMAGE_SIZE (JBOD_NUM_DISKS * JBOD_DISK_SIZE)
+#define MMAP_SERVER_DEFAULT_IMAGE "jbod.img"
+
+/* Bytes of requests received from a client at once, and of responses
+ * gathered for it before they are sent; every request that arrived
+ * together is carried out before the responses go out in one send. */
+#define MMAP_SERVER_BUFFER_SIZE 65536
+
+/* Most sockets the event loop serves per wakeup. */
+#define MMAP_SERVER_MAX_EVENTS 64
+
+/* Longest packet of the protocol: a header and a block. */
+#define MMAP_SERVER_MAX_PACKET (HEADER_LEN + JBOD_BLOCK_SIZE)
+
+#endif
@@ -1,5 +1,6 @@
 #include "net.h"
 #include "jbod.h"
+#include "stats.h"
 #include <arpa/inet.h>
 #include <err.h>
 #include <errno.h>
@@ -7,189 +8,690 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
-// the client socket descriptor for the connection to the server
-int cli_sd = -1;
+// an operation on a connection: its encoded header, a copy of the block it writes or where the block it reads goes,
+// and whom to tell once its response is in
+typedef struct {
+    uint8_t header[HEADER_LEN];
+    uint8_t payload[JBOD_BLOCK_SIZE];
+    uint8_t *block;
+    bool has_payload;
+    bool seek; // a seek queued for the block operation after it, which fails if the seek does
+    uint64_t queued_ns; // when it was queued, for its latency
+    jbod_callback_t done;
+    void *arg;
+} queued_op_t;
+
+// a connection to the server; its operations sit in a ring in the order they were queued, the oldest ones have been
+// sent and wait for their responses, the rest still have to go out. The server keeps a head position per connection,
+// and so does the connection: where the head will be once everything queued has been carried out
+struct jbod_conn {
+    int sd;
+    int cur_disk;   // -1 means the head position is unknown and the next block operation must seek
+    int cur_block;
+    unsigned epoch; // mount_epoch when the head position was last known
+    bool seek_failed; // a seek for the block operation about to be answered failed
+    queued_op_t ops[JBOD_MAX_BATCH];
+    int first;           // ring index of the oldest operation, the next one to be answered
+    int num_ops;         // operations queued and not answered yet
+    int num_sent;        // how many of them went out completely
+    size_t partial_sent; // bytes of the next operation to go out that were written already
+
+    uint8_t response[HEADER_LEN]; // header of the response being received
+    size_t received;              // bytes of that response received so far
+
+    bool failed;   // an operation without a callback failed since the last flush
+    bool broken;   // the connection failed; nothing more goes over it
+    bool watched;  // added to the event loop
+    bool want_out; // the event loop waits for room in the socket to send the rest
+    jbod_conn_t *next_watched;
+};
+
+// the connection opened by jbod_connect, used by the jbod_client_* functions
+static jbod_conn_t client = {.sd = -1, .cur_disk = -1, .cur_block = -1};
+
+// the pool opened by jbod_connect_pool or jbod_connect_servers, num_conns connections per server one server after the
+// other; the client connection comes first
+static jbod_conn_t *pool[JBOD_MAX_SERVERS * JBOD_MAX_CONNECTIONS] = {&client};
+static int pool_size = 0;
+static int num_servers = 1;
+static int conns_per_server = 1;
+
+// bumped by every mount and unmount, which leave the head of every connection somewhere new
+static atomic_uint mount_epoch = 0;
+
+// number of seek commands that were dropped because the head was already in place
+static atomic_ulong seeks_saved = 0;
+
+// the event loop: an epoll instance over the connections added to it
+static int epoll_fd = -1;
+static jbod_conn_t *watched = NULL;
+
+// the operation at position i of the ring, counting from the oldest
+static queued_op_t *op_at(jbod_conn_t *conn, int i) { return &conn->ops[(conn->first + i) % JBOD_MAX_BATCH]; }
+
+// bytes an operation takes up on the wire
+static size_t op_size(const queued_op_t *op) { return HEADER_LEN + (op->has_payload ? JBOD_BLOCK_SIZE : 0); }
+
+// forgets the head position of conn, e.g. after a failed operation left it uncertain
+static void forget_position(jbod_conn_t *conn) {
+    conn->cur_disk = -1;
+    conn->cur_block = -1;
+}
+
+// reports the outcome of the oldest operation and drops it from the ring; a block operation fails along with its seeks
+static void complete_oldest(jbod_conn_t *conn, bool ok) {
+    queued_op_t *op = op_at(conn, 0);
+
+    conn->first = (conn->first + 1) % JBOD_MAX_BATCH;
+    conn->num_ops--;
+    conn->num_sent--;
+    stats_record(STATS_JBOD_LATENCY, stats_now() - op->queued_ns);
+    if (!ok) {
+        stats_add(STATS_JBOD_FAILURES, 1);
+        forget_position(conn);
+    }
+    if (op->seek) {
+        conn->seek_failed |= !ok;
+        return;
+    }
+    ok = ok && !conn->seek_failed;
+    conn->seek_failed = false;
+    if (op->done != NULL) {
+        op->done(op->arg, ok);
+    } else if (!ok) {
+        conn->failed = true;
+    }
+}
+
+// the connection broke: every operation still on it fails, and so does everything queued on it later
+static void fail_all(jbod_conn_t *conn) {
+    conn->broken = true;
+    conn->num_sent = conn->num_ops;
+    conn->partial_sent = 0;
+    conn->received = 0;
+    while (conn->num_ops > 0) {
+        complete_oldest(conn, false);
+    }
+}
+
+// encodes the packet header for op into header; returns true if the packet carries a block after the header
+static bool encode_header(uint32_t op, uint8_t *header) {
+
+    // declare a variable to store the length of the packet
+    uint16_t len = HEADER_LEN;
+
+    // extract the command from the op code
+    uint32_t cmd = op >> 26;
+
+    // if the command is JBOD_WRITE_BLOCK, then set the length of the packet to the sum of the header length and the JBOD block size.
+    // Otherwise, set the length of the packet to the header length
+    if (cmd == JBOD_WRITE_BLOCK) {
+        len += JBOD_BLOCK_SIZE;
+    }
+
+    // convert the length of the packet to network byte order
+    len = htons(len);
 
-// attempts to read n bytes from fd; returns true on success and false on failure
-static bool nread(int fd, int len, uint8_t *buf) {
+    // convert the op code to network byte order
+    op = htonl(op);
 
-    // declare a variable to store the number of bytes read so far
-    int n_read = 0;
+    // copy the length of the packet into the header buffer, followed by the op code; the return code is left zero
+    memset(header, 0, HEADER_LEN);
+    memcpy(header, &len, sizeof(len));
+    memcpy(header + 2, &op, sizeof(op));
 
-    // loop to keep reading until the specified number of bytes have been read
-    while (n_read < len) {
+    return cmd == JBOD_WRITE_BLOCK;
+}
 
-        // use read() system call to read the remaining bytes from fd
-        int n = read(fd, &buf[n_read], len - n_read);
+// writes the operations that have not gone out yet to the socket in one sendmsg, resuming after a partial write;
+// with MSG_DONTWAIT in flags it stops when the socket is full. Returns false if the connection failed
+static bool send_some(jbod_conn_t *conn, int flags) {
+    while (conn->num_sent < conn->num_ops) {
+        struct iovec iov[2 * JBOD_MAX_BATCH];
+        size_t skip = conn->partial_sent;
+        int iovcnt = 0;
+
+        // gather the headers and the blocks of write operations into a single vector, minus what went out already
+        for (int i = conn->num_sent; i < conn->num_ops; i++) {
+            queued_op_t *op = op_at(conn, i);
+            uint8_t *parts[2] = {op->header, op->block};
+            size_t lens[2] = {HEADER_LEN, op->has_payload ? JBOD_BLOCK_SIZE : 0};
+
+            for (int j = 0; j < 2; j++) {
+                if (skip >= lens[j]) {
+                    skip -= lens[j];
+                    continue;
+                }
+                iov[iovcnt].iov_base = parts[j] + skip;
+                iov[iovcnt].iov_len = lens[j] - skip;
+                iovcnt++;
+                skip = 0;
+            }
+        }
 
-        // if read() returns a non-positive value, it indicates a failure, so return false
-        if (n < 0) {
+        struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iovcnt};
+        ssize_t n = sendmsg(conn->sd, &msg, flags | MSG_NOSIGNAL);
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) && (flags & MSG_DONTWAIT)) {
+            return true;
+        }
+        if (n <= 0) {
             return false;
         }
-        n_read += n;
+
+        // count the operations that went out completely and remember how far the next one got
+        n += conn->partial_sent;
+        while (conn->num_sent < conn->num_ops && (size_t)n >= op_size(op_at(conn, conn->num_sent))) {
+            n -= op_size(op_at(conn, conn->num_sent));
+            conn->num_sent++;
+        }
+        conn->partial_sent = n;
     }
     return true;
 }
 
-// attempts to write n bytes to fd; returns true on success and false on failure
-static bool nwrite(int fd, int len, uint8_t *buf) {
-
-    // declare a variable to store the number of bytes written so far
-    int n_write = 0;
+// receives the responses to the operations that went out, in order, and reports each one until no more than keep of
+// them wait for an answer; with MSG_DONTWAIT in flags it stops when nothing more has arrived. Returns false if the
+// connection failed
+static bool recv_some(jbod_conn_t *conn, int flags, int keep) {
 
-    // loop to keep writing until the specified number of bytes have been written
-    while (n_write < len) {
+    // acknowledge right away so a server holding back small replies does not wait on our delayed ACK; the kernel
+    // drops back to delayed ACKs on its own after a while, so this is renewed once per call rather than once per recv
+    if (conn->num_sent > keep) {
+        int one = 1;
+        setsockopt(conn->sd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+    }
 
-        // use write() system call to write the remaining bytes to fd
-        int n = write(fd, &buf[n_write], len - n_write);
+    while (conn->num_sent > keep) {
+        queued_op_t *op = op_at(conn, 0);
+        uint8_t scratch[JBOD_BLOCK_SIZE];
+        uint8_t *dest = conn->response + conn->received;
+        size_t want = HEADER_LEN - conn->received;
+        uint16_t len;
+        uint16_t ret;
+
+        // the block comes right after the header, if the length in the header says there is one
+        if (conn->received >= HEADER_LEN) {
+            dest = (op->block != NULL && !op->has_payload ? op->block : scratch) + (conn->received - HEADER_LEN);
+            want = HEADER_LEN + JBOD_BLOCK_SIZE - conn->received;
+        }
 
-        // if write() returns a non-positive value, it indicates a failure, so return false
-        if (n < 0) {
+        ssize_t n = recv(conn->sd, dest, want, flags);
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK) && (flags & MSG_DONTWAIT)) {
+            return true;
+        }
+        if (n <= 0) {
             return false;
         }
-        n_write += n;
+        conn->received += n;
+        if (conn->received < HEADER_LEN) {
+            continue;
+        }
+
+        // the length and the return code are in network byte order; the op code is the one we sent
+        memcpy(&len, conn->response, sizeof(len));
+        memcpy(&ret, conn->response + 6, sizeof(ret));
+        len = ntohs(len);
+        ret = ntohs(ret);
+        if (len == HEADER_LEN + JBOD_BLOCK_SIZE && conn->received < HEADER_LEN + JBOD_BLOCK_SIZE) {
+            continue;
+        }
+        if (len == HEADER_LEN + JBOD_BLOCK_SIZE) {
+            stats_add(STATS_BYTES_RECEIVED, JBOD_BLOCK_SIZE);
+        }
+        conn->received = 0;
+        complete_oldest(conn, ret == 0);
     }
     return true;
 }
 
-// attempts to receive a packet from fd; returns true on success and false on failure
-static bool recv_packet(int fd, uint32_t *op, uint16_t *ret, uint8_t *block) {
+// sends everything queued on conn and waits for all of it to be answered; returns false if the connection failed
+static bool drain(jbod_conn_t *conn) {
+    if (!send_some(conn, 0) || !recv_some(conn, 0, 0)) {
+        fail_all(conn);
+        return false;
+    }
+    return true;
+}
 
-    // declare variables to store the length of the packet, the operation code, the return code, and the data block
-    uint16_t len;
-    uint8_t header[HEADER_LEN];
+// makes room in the full ring of conn: sends everything queued but waits only for the oldest quarter of it to be
+// answered, so a long stream of operations keeps the connection busy instead of stopping for every batch
+static bool make_room(jbod_conn_t *conn) {
+    if (!send_some(conn, 0) || !recv_some(conn, 0, JBOD_MAX_BATCH - JBOD_MAX_BATCH / 4)) {
+        fail_all(conn);
+        return false;
+    }
+    return true;
+}
 
-    // call nread function to read HEADER_LEN bytes from fd into header. If it fails, return false
-    if (nread(fd, HEADER_LEN, header) == false) {
+// how long probe waits for the answer, 0 to not probe at all
+static int connect_timeout_ms = JBOD_CONNECT_TIMEOUT_MS;
+
+// asks the signature of block 0 of disk 0 over the new connection sd, which neither moves the head nor touches the
+// disks, and waits for the answer, whatever it says: a server that leaves the connection in its backlog, as one that
+// serves a single client at a time does, would never answer anything sent over it. Returns true if the answer came in
+// time
+static bool probe(int sd) {
+    uint8_t packet[HEADER_LEN + JBOD_BLOCK_SIZE];
+    struct pollfd pfd = {.fd = sd, .events = POLLIN};
+    size_t received = 0, expected = HEADER_LEN;
+
+    encode_header((uint32_t)JBOD_SIGN_BLOCK << 26, packet);
+    if (send(sd, packet, HEADER_LEN, MSG_NOSIGNAL) != (ssize_t)HEADER_LEN) {
         return false;
     }
 
-    // copy the next sizeof(len) bytes from header and store it in len
-    memcpy(&len, header, sizeof(len));
+    // the header says whether the signature follows it
+    while (received < expected) {
+        if (poll(&pfd, 1, connect_timeout_ms) != 1) {
+            return false;
+        }
+        ssize_t n = recv(sd, packet + received, expected - received, 0);
+        if (n <= 0) {
+            return false;
+        }
+        received += n;
+        if (received == HEADER_LEN) {
+            uint16_t len;
+            memcpy(&len, packet, sizeof(len));
+            expected = ntohs(len) > HEADER_LEN ? HEADER_LEN + JBOD_BLOCK_SIZE : HEADER_LEN;
+        }
+    }
+    return true;
+}
+
+void jbod_set_connect_timeout(int timeout_ms) { connect_timeout_ms = timeout_ms; }
+
+static int open_socket(const char *ip, uint16_t port) {
 
-    // copy the next sizeof(*op) bytes from header and store it in the memory location pointed to by op
-    memcpy(op, header + 2, sizeof(*op));
+    // declare a structure to store the address information for the server
+    struct sockaddr_in caddr;
 
-    // copy the next sizeof(*ret) bytes from header and store it in the memory location pointed to by ret
-    memcpy(ret, header + 6, sizeof(*ret));
+    // create a socket
+    int sd = socket(AF_INET, SOCK_STREAM, 0);
 
-    // convert the length of the packet from network byte order to host byte order
-    len = ntohs(len);
+    // if the socket could not be created, return -1
+    if (sd == -1) {
+        return -1;
+    }
 
-    // convert the operation code from network byte order to host byte order
-    *op = ntohl(*op);
+    // set the family field of the address structure to AF_INET, which indicates that the server uses IPv4
+    caddr.sin_family = AF_INET;
 
-    // convert the return code from network byte order to host byte order
-    *ret = ntohs(*ret);
+    // set the port field of the address structure to the specified port number
+    caddr.sin_port = htons(port);
 
-    // if len is equal to HEADER_LEN + JBOD_BLOCK_SIZE, call nread function to read 256 bytes from fd into block. If it fails, return false
-    if (len == (HEADER_LEN + JBOD_BLOCK_SIZE)) {
-        if (nread(fd, JBOD_BLOCK_SIZE, block) == false) {
-            return false;
+    // convert the IP address from a string to a binary format, then connect to the server
+    if (inet_aton(ip, &caddr.sin_addr) == 0 || connect(sd, (const struct sockaddr *)&caddr, sizeof(caddr)) == -1) {
+        close(sd);
+        return -1;
+    }
+
+    // a batch goes out in a single write and the reply is awaited right after, so do not let Nagle hold it back
+    int one = 1;
+    setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // fail now rather than hang on the first operation over a connection the server never serves
+    if (connect_timeout_ms > 0 && !probe(sd)) {
+        close(sd);
+        return -1;
+    }
+    return sd;
+}
+
+// resets conn to a fresh connection over sd
+static void init_conn(jbod_conn_t *conn, int sd) {
+    memset(conn, 0, sizeof(*conn));
+    conn->sd = sd;
+    forget_position(conn);
+}
+
+// takes conn out of the event loop
+static void unwatch(jbod_conn_t *conn) {
+    if (!conn->watched) {
+        return;
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->sd, NULL);
+    for (jbod_conn_t **p = &watched; *p != NULL; p = &(*p)->next_watched) {
+        if (*p == conn) {
+            *p = conn->next_watched;
+            break;
         }
     }
-    return true;
+    conn->watched = false;
 }
 
-// attempts to send a packet to sd; returns true on success and false on failure
-static bool send_packet(int sd, uint32_t op, uint8_t *block) {
+// closes the socket of conn after sending whatever is still queued on it
+static void close_conn(jbod_conn_t *conn) {
+    if (conn->sd == -1) {
+        return;
+    }
 
-    // declare variables to store the length of the packet, the operation code, and the data block
-    uint8_t header[HEADER_LEN];
-    uint16_t len = HEADER_LEN;
+    // send whatever is still queued so write-backs are not lost on the way out
+    drain(conn);
+    unwatch(conn);
+    close(conn->sd);
+    conn->sd = -1;
+}
 
-    // extract the command from the op code
-    uint32_t cmd = op >> 26;
+// attempts to connect to server and set up the client connection; returns true if successful and false if not
+bool jbod_connect(const char *ip, uint16_t port) { return jbod_connect_pool(ip, port, 1); }
 
-    // if the command is JBOD_WRITE_BLOCK, then set the length of the packet to the sum of the header length and the JBOD block size.
-    // Otherwise, set the length of the packet to the header length
-    if (cmd == JBOD_WRITE_BLOCK) {
-        len += JBOD_BLOCK_SIZE;
+// disconnects every connection of the pool from the servers, the client connection last
+void jbod_disconnect(void) {
+    while (pool_size > 1) {
+        jbod_conn_close(pool[--pool_size]);
     }
+    close_conn(&client);
+    pool_size = 0;
+    num_servers = 1;
+    conns_per_server = 1;
+}
 
-    // convert the length of the packet to network byte order
-    len = htons(len);
+bool jbod_connect_pool(const char *ip, uint16_t port, int num_conns) {
+    jbod_server_t server = {ip, port};
 
-    // convert the op code to network byte order
-    op = htonl(op);
+    return jbod_connect_servers(&server, 1, num_conns);
+}
 
-    // copy the length of the packet into the header buffer
-    memcpy(header, &len, sizeof(len));
+int jbod_parse_servers(char *list, jbod_server_t *servers, int max) {
+    int n = 0;
 
-    // copy the op code into the header buffer
-    memcpy(header + 2, &op, sizeof(op));
+    for (char *save = NULL, *entry = strtok_r(list, ",", &save); entry != NULL; entry = strtok_r(NULL, ",", &save)) {
+        char *colon = strrchr(entry, ':');
+        if (n == max || colon == NULL || colon == entry || atoi(colon + 1) <= 0 || atoi(colon + 1) > UINT16_MAX) {
+            return -1;
+        }
+        *colon = '\0';
+        servers[n].ip = entry;
+        servers[n].port = atoi(colon + 1);
+        n++;
+    }
+    return n > 0 ? n : -1;
+}
+
+bool jbod_connect_servers(const jbod_server_t *servers, int count, int num_conns) {
 
-    // attempt to write the header to the socket descriptor using the nwrite function
-    if (nwrite(sd, HEADER_LEN, header) == false) {
+    // the connections of a pool that is still open would be lost, so it has to be disconnected first
+    if (pool_size > 0 || client.sd != -1 || count < 1 || count > JBOD_MAX_SERVERS || num_conns < 1 || num_conns > JBOD_MAX_CONNECTIONS) {
         return false;
     }
-
-    // if the command is JBOD_WRITE_BLOCK, attempt to write the block of data to the socket descriptor
-    if (cmd == JBOD_WRITE_BLOCK) {
-        if (nwrite(sd, JBOD_BLOCK_SIZE, block) == false) {
+    init_conn(&client, open_socket(servers[0].ip, servers[0].port));
+    if (client.sd == -1) {
+        return false;
+    }
+    pool_size = 1;
+
+    // the pool is driven by the event loop of whoever polls, as well as by the blocking flushes
+    while (pool_size < count * num_conns) {
+        const jbod_server_t *server = &servers[pool_size / num_conns];
+        pool[pool_size] = jbod_conn_open(server->ip, server->port);
+        if (pool[pool_size] == NULL) {
+            jbod_disconnect();
+            return false;
+        }
+        pool_size++;
+    }
+    num_servers = count;
+    conns_per_server = num_conns;
+    for (int i = 0; i < pool_size; i++) {
+        if (jbod_poll_add(pool[i]) == -1) {
+            jbod_disconnect();
             return false;
         }
     }
     return true;
 }
 
-// declare a structure to store the address information for the server
-struct sockaddr_in caddr;
+int jbod_num_servers(void) { return num_servers; }
 
-// attempts to connect to server and set the global cli_sd variable to the socket; returns true if successful and false if not
-bool jbod_connect(const char *ip, uint16_t port) {
+int jbod_pool_size(void) { return pool_size; }
 
-    // create a socket
-    cli_sd = socket(AF_INET, SOCK_STREAM, 0);
+jbod_conn_t *jbod_pool_conn(int index) { return pool[index]; }
 
-    // if the socket could not be created, return false
-    if (cli_sd == -1) {
-        return false;
+jbod_conn_t *jbod_route(int disk_num) {
+    if (pool_size == 0) {
+        return &client;
     }
+    int server = disk_num / JBOD_NUM_DISKS;
+    return pool[server * conns_per_server + disk_num % JBOD_NUM_DISKS % conns_per_server];
+}
 
-    // set the family field of the address structure to AF_INET, which indicates that the server uses IPv4
-    caddr.sin_family = AF_INET;
+int jbod_pool_flush(void) {
+    int rc = 0;
 
-    // set the port field of the address structure to the specified port number
-    caddr.sin_port = htons(port);
+    // everything goes out first so the servers work at the same time, then the responses are collected
+    for (int i = 0; i < pool_size; i++) {
+        if (pool[i]->sd != -1 && !pool[i]->broken && !send_some(pool[i], 0)) {
+            fail_all(pool[i]);
+        }
+    }
+    for (int i = 0; i < pool_size; i++) {
+        if (jbod_conn_flush(pool[i]) == -1) {
+            rc = -1;
+        }
+    }
+    return rc;
+}
 
-    // convert the IP address from a string to a binary format
-    if (inet_aton(ip, &caddr.sin_addr) == 0) {
-        return false;
+jbod_conn_t *jbod_conn_open(const char *ip, uint16_t port) {
+    jbod_conn_t *conn = malloc(sizeof(*conn));
+    if (conn == NULL) {
+        return NULL;
+    }
+    init_conn(conn, open_socket(ip, port));
+    if (conn->sd == -1) {
+        free(conn);
+        return NULL;
     }
+    return conn;
+}
 
-    // connect to the server
-    if (connect(cli_sd, (const struct sockaddr *)&caddr, sizeof(caddr)) == -1) {
-        return false;
+void jbod_conn_close(jbod_conn_t *conn) {
+    if (conn == NULL) {
+        return;
     }
-    return true;
+    close_conn(conn);
+    free(conn);
 }
 
-// disconnects from the server and resets cli_sd
-void jbod_disconnect(void) {
+// keeps the head position of conn in step with op, which is about to be queued on it
+static void track_head(jbod_conn_t *conn, uint32_t op) {
+    switch (op >> 26) {
+    case JBOD_MOUNT:
+    case JBOD_UNMOUNT:
+        mount_epoch++;
+        forget_position(conn);
+        break;
+    case JBOD_SEEK_TO_DISK:
+        conn->cur_disk = (op >> 22) & 0xf;
+        conn->cur_block = 0;
+        break;
+    case JBOD_SEEK_TO_BLOCK:
+        conn->cur_block = conn->cur_disk == -1 ? -1 : (int)(op & 0xff);
+        break;
+    case JBOD_READ_BLOCK:
+    case JBOD_WRITE_BLOCK:
+        // JBOD moves the head to the next block afterwards
+        if (conn->cur_block != -1) {
+            conn->cur_block++;
+        }
+        break;
+    }
+}
+
+// queues op on conn; see jbod_conn_submit. A seek queued for a block operation reports its failure through that, and
+// the block of a write is copied unless the caller lends it with JBOD_BORROW_BLOCK
+static int submit_op(jbod_conn_t *conn, uint32_t op, uint8_t *block, int flags, jbod_callback_t done, void *arg, bool seek) {
+    if (conn->sd == -1 || conn->broken) {
+        return -1;
+    }
+    if (conn->num_ops == JBOD_MAX_BATCH && !make_room(conn)) {
+        return -1;
+    }
 
-    // close the socket
-    close(cli_sd);
+    // the block of a write is copied so the caller may reuse its buffer as soon as this returns, unless it is lent
+    queued_op_t *queued = op_at(conn, conn->num_ops);
+    queued->has_payload = encode_header(op, queued->header);
+    queued->block = block;
+    queued->seek = seek;
+    queued->done = done;
+    queued->arg = arg;
+    queued->queued_ns = stats_now();
+    stats_count_command(op >> 26);
+    if (queued->has_payload) {
+        stats_add(STATS_BYTES_SENT, JBOD_BLOCK_SIZE);
+    }
+    if (queued->has_payload && !(flags & JBOD_BORROW_BLOCK)) {
+        memcpy(queued->payload, block, JBOD_BLOCK_SIZE);
+        queued->block = queued->payload;
+    }
+    conn->num_ops++;
+    track_head(conn, op);
+    return 0;
+}
 
-    // reset the global variable cli_sd to -1
-    cli_sd = -1;
+// queues the JBOD operation on conn to go out with its next flush or poll, making room first if the ring is full
+int jbod_conn_submit(jbod_conn_t *conn, uint32_t op, uint8_t *block, jbod_callback_t done, void *arg) {
+    return submit_op(conn, op, block, 0, done, arg, false);
 }
 
-// sends the JBOD operation to the server and receives and processes the response
-int jbod_client_operation(uint32_t op, uint8_t *block) {
-    uint16_t ret;
-    if (cli_sd == -1) {
+// the op code of a command on a disk and block
+static uint32_t block_op(int cmd, int disk_num, int block_num) { return (uint32_t)cmd << 26 | disk_num << 22 | block_num; }
+
+// queues the seeks to the disk and block that the head position of conn does not make redundant, then the operation;
+// seeking to a disk also puts the head on its block 0
+int jbod_conn_submit_block(jbod_conn_t *conn, int cmd, int disk_num, int block_num, uint8_t *block, int flags, jbod_callback_t done, void *arg) {
+    if (conn->epoch != mount_epoch) {
+        conn->epoch = mount_epoch;
+        forget_position(conn);
+    }
+
+    if (conn->cur_disk == disk_num) {
+        seeks_saved++;
+    } else if (submit_op(conn, block_op(JBOD_SEEK_TO_DISK, disk_num, 0), NULL, 0, NULL, NULL, true) == -1) {
+        return -1;
+    }
+
+    if (conn->cur_block == block_num) {
+        seeks_saved++;
+    } else if (submit_op(conn, block_op(JBOD_SEEK_TO_BLOCK, 0, block_num), NULL, 0, NULL, NULL, true) == -1) {
+        return -1;
+    }
+    return submit_op(conn, block_op(cmd, 0, 0), block, flags, done, arg, false);
+}
+
+int jbod_conn_pending(jbod_conn_t *conn) { return conn->num_ops; }
+
+// seeking to a disk also puts the head on its block 0, and a mount or unmount since the head was last known leaves it
+// anywhere
+int jbod_conn_seeks_needed(jbod_conn_t *conn, int disk_num, int block_num) {
+    bool on_disk = conn->epoch == mount_epoch && conn->cur_disk == disk_num;
+    int cur_block = on_disk ? conn->cur_block : 0;
+
+    return !on_disk + (cur_block != block_num);
+}
+
+unsigned long jbod_seeks_saved(void) { return seeks_saved; }
+
+int jbod_conn_queue(jbod_conn_t *conn, uint32_t op, uint8_t *block) { return jbod_conn_submit(conn, op, block, NULL, NULL); }
+
+// sends every operation queued on conn and then receives the responses in the order the operations were queued
+int jbod_conn_flush(jbod_conn_t *conn) {
+    bool ok = drain(conn) && !conn->failed;
+
+    conn->failed = false;
+    return ok ? 0 : -1;
+}
+
+int jbod_poll_add(jbod_conn_t *conn) {
+    if (conn->watched) {
+        return 0;
+    }
+    if (conn->sd == -1) {
         return -1;
-    } else {
-        if (send_packet(cli_sd, op, block) == true) {
-            recv_packet(cli_sd, &op, &ret, block);
-            return 0;
-        } else {
+    }
+    if (epoll_fd == -1) {
+        epoll_fd = epoll_create1(0);
+        if (epoll_fd == -1) {
             return -1;
         }
     }
-}
\ No newline at end of file
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = conn};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->sd, &ev) == -1) {
+        return -1;
+    }
+    conn->watched = true;
+    conn->want_out = false;
+    conn->next_watched = watched;
+    watched = conn;
+    return 0;
+}
+
+int jbod_poll(int timeout_ms) {
+    struct epoll_event events[JBOD_MAX_POLL_EVENTS];
+    int completed = 0;
+    int busy = 0;
+
+    // push out what is queued everywhere before waiting; whatever does not fit goes out once the socket has room
+    for (jbod_conn_t *conn = watched; conn != NULL; conn = conn->next_watched) {
+        if (conn->num_sent < conn->num_ops && !send_some(conn, MSG_DONTWAIT)) {
+            fail_all(conn);
+        }
+        bool want_out = conn->num_sent < conn->num_ops;
+        if (want_out != conn->want_out) {
+            struct epoll_event ev = {.events = EPOLLIN | (want_out ? EPOLLOUT : 0), .data.ptr = conn};
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->sd, &ev);
+            conn->want_out = want_out;
+        }
+        busy += conn->num_ops;
+    }
+    if (busy == 0) {
+        return 0;
+    }
+
+    int n = epoll_wait(epoll_fd, events, JBOD_MAX_POLL_EVENTS, timeout_ms);
+    if (n == -1) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (int i = 0; i < n; i++) {
+        jbod_conn_t *conn = events[i].data.ptr;
+        int before = conn->num_ops;
+
+        if ((events[i].events & EPOLLOUT) && !send_some(conn, MSG_DONTWAIT)) {
+            fail_all(conn);
+        }
+        if ((events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && !recv_some(conn, MSG_DONTWAIT, 0)) {
+            fail_all(conn);
+        }
+        completed += before - conn->num_ops;
+    }
+    return completed;
+}
+
+int jbod_client_queue(uint32_t op, uint8_t *block) { return jbod_conn_queue(&client, op, block); }
+
+int jbod_client_flush(void) { return jbod_conn_flush(&client); }
+
+// sends the JBOD operation to the server and receives and processes the response
+int jbod_client_operation(uint32_t op, uint8_t *block) { return jbod_server_operation(0, op, block); }
+
+int jbod_server_operation(int server, uint32_t op, uint8_t *block) {
+    jbod_conn_t *conn = pool_size > 0 ? pool[server * conns_per_server] : &client;
+
+    // anything queued earlier, on any connection of the pool, must reach the server first so operations stay in order
+    if (server < 0 || server >= num_servers || jbod_pool_flush() == -1 || jbod_conn_queue(conn, op, block) == -1) {
+        return -1;
+    }
+    return jbod_conn_flush(conn);
+}
@@ -4,12 +4,171 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+#include "jbod.h"
+
 #define HEADER_LEN (sizeof(uint16_t) + sizeof(uint32_t) + sizeof(uint16_t))
 #define JBOD_SERVER "127.0.0.1"
 #define JBOD_PORT 3333
 
+/* Most JBOD servers the linear device can span; their disks are numbered
+ * one server after the other, JBOD_NUM_DISKS per server. */
+#define JBOD_MAX_SERVERS 8
+#define JBOD_MAX_DISKS (JBOD_MAX_SERVERS * JBOD_NUM_DISKS)
+
+/* Maximum number of operations queued or in flight on one connection.
+ * Queuing more sends them all and waits for the oldest quarter to be
+ * answered, so long transfers stream while the server never has to buffer
+ * more than this before we start reading its responses. */
+#define JBOD_MAX_BATCH 64
+
+/* Most connections the event loop handles per jbod_poll call. */
+#define JBOD_MAX_POLL_EVENTS 64
+
+/* Most connections to a server in the pool opened by jbod_connect_pool. */
+#define JBOD_MAX_CONNECTIONS 16
+
+/* How long a server may take by default to answer the probe sent over
+ * every new connection before the connection counts as failed. A server
+ * that serves one connection at a time accepts the others but never reads
+ * from them, so without the probe their first operations would wait
+ * forever. The probe asks for a block signature, which leaves the head
+ * and the disks alone. */
+#define JBOD_CONNECT_TIMEOUT_MS 2000
+
+/* Sets how long the probe of each connection opened from now on may wait
+ * for its answer, in milliseconds; 0 opens connections without probing
+ * them. */
+void jbod_set_connect_timeout(int timeout_ms);
+
 int jbod_client_operation(uint32_t op, uint8_t *block);
+
+/* Returns 0 on success and -1 on failure. Queues |op| to be sent with the
+ * next jbod_client_flush instead of waiting for its response. The block of
+ * a write is copied right away; the destination |block| of a read must
+ * stay valid until the batch has been flushed. */
+int jbod_client_queue(uint32_t op, uint8_t *block);
+
+/* Returns 0 if every queued operation succeeded and -1 otherwise. Sends all
+ * queued operations in a single write and collects their responses in the
+ * order they were queued. */
+int jbod_client_flush(void);
+
 bool jbod_connect(const char *ip, uint16_t port);
 void jbod_disconnect(void);
 
+/* Returns true on success and false on failure. Like jbod_connect, but
+ * opens a pool of |num_conns| connections to the server; the first one is
+ * the client connection. Operations on a disk go over the connection
+ * jbod_route picks for it, so independent requests on different disks
+ * overlap on the wire. The server has to keep a separate head position
+ * for each connection. jbod_disconnect closes the whole pool. */
+bool jbod_connect_pool(const char *ip, uint16_t port, int num_conns);
+
+/* A JBOD server to connect to. */
+typedef struct {
+  const char *ip;
+  uint16_t port;
+} jbod_server_t;
+
+/* Returns the number of servers on success and -1 on failure. Parses
+ * |list|, a comma separated list of ip:port endpoints, into |servers|,
+ * which has room for |max| of them; the ip strings point into |list|,
+ * which is modified. */
+int jbod_parse_servers(char *list, jbod_server_t *servers, int max);
+
+/* Returns true on success and false on failure. Like jbod_connect_pool,
+ * with |num_conns| connections to each of |num_servers| servers, whose
+ * disks become disks s * JBOD_NUM_DISKS and on for server s. The client
+ * connection goes to the first server. Fails while connected already;
+ * jbod_disconnect first. */
+bool jbod_connect_servers(const jbod_server_t *servers, int num_servers, int num_conns);
+
+/* Returns the number of servers connected to, at least 1. */
+int jbod_num_servers(void);
+
+/* Returns 0 on success and -1 on failure. Like jbod_client_operation, on
+ * the first connection to server |server|. */
+int jbod_server_operation(int server, uint32_t op, uint8_t *block);
+
+/* A connection to a JBOD server with its own batch of queued operations.
+ * The jbod_client_* functions above act on the client connection opened
+ * by jbod_connect or jbod_connect_pool; further connections let several
+ * threads talk to the server at once, one connection per thread. */
+typedef struct jbod_conn jbod_conn_t;
+
+/* Returns a new connection to the server at |ip|:|port|, or NULL on
+ * failure. */
+jbod_conn_t *jbod_conn_open(const char *ip, uint16_t port);
+
+/* Sends whatever is still queued on |conn|, then closes and frees it. */
+void jbod_conn_close(jbod_conn_t *conn);
+
+/* Like jbod_client_queue and jbod_client_flush, on |conn|. */
+int jbod_conn_queue(jbod_conn_t *conn, uint32_t op, uint8_t *block);
+int jbod_conn_flush(jbod_conn_t *conn);
+
+/* Told whether an operation queued with jbod_conn_submit succeeded. Runs
+ * inside jbod_poll or whichever call made the operation complete, so it
+ * must not queue operations itself. */
+typedef void (*jbod_callback_t)(void *arg, bool ok);
+
+/* Returns 0 on success and -1 on failure. Like jbod_conn_queue, but once
+ * the response arrives |done| is called with |arg| instead of the outcome
+ * being folded into the next jbod_conn_flush. */
+int jbod_conn_submit(jbod_conn_t *conn, uint32_t op, uint8_t *block, jbod_callback_t done, void *arg);
+
+/* For jbod_conn_submit_block: send a write straight from the caller's
+ * block, which must stay untouched until the operation completes, instead
+ * of copying it when it is queued. */
+#define JBOD_BORROW_BLOCK 1
+
+/* Returns 0 on success and -1 on failure. Queues a read or write (|cmd|) of
+ * block |block_num| of |disk_num| on |conn| like jbod_conn_submit, preceded
+ * by the seeks it needs. Each connection keeps track of where the head of
+ * the server will be for it once everything queued on it has been carried
+ * out, so seeks to where the head already is are left out. |done| is
+ * called once for the whole thing and fails if any of the seeks did. A
+ * read lands straight in |block|; |flags| may hold JBOD_BORROW_BLOCK. */
+int jbod_conn_submit_block(jbod_conn_t *conn, int cmd, int disk_num, int block_num, uint8_t *block, int flags, jbod_callback_t done, void *arg);
+
+/* Returns the number of operations queued on |conn| and not answered
+ * yet. */
+int jbod_conn_pending(jbod_conn_t *conn);
+
+/* Returns how many seek commands jbod_conn_submit_block would queue on
+ * |conn| in front of an operation on block |block_num| of |disk_num|, going
+ * by where the head will be once everything queued has been carried out:
+ * 0, 1 or 2. */
+int jbod_conn_seeks_needed(jbod_conn_t *conn, int disk_num, int block_num);
+
+/* Returns how many seek commands jbod_conn_submit_block left out. */
+unsigned long jbod_seeks_saved(void);
+
+/* Returns 0 on success and -1 on failure. Adds |conn| to the event loop
+ * run by jbod_poll, unless it is in it already. Only the thread that polls
+ * may touch the connections in the event loop. */
+int jbod_poll_add(jbod_conn_t *conn);
+
+/* Runs the event loop once. Sends what is queued on its connections
+ * without blocking, waits up to
+ * |timeout_ms| (-1 waits indefinitely) for their sockets, then sends and
+ * receives what they are ready for. Returns the number of operations
+ * completed, 0 if nothing is in flight, and -1 on failure. */
+int jbod_poll(int timeout_ms);
+
+/* Returns the number of connections in the pool, and the one at |index|. */
+int jbod_pool_size(void);
+jbod_conn_t *jbod_pool_conn(int index);
+
+/* Returns the connection of the pool that carries the operations on
+ * |disk_num|, numbered across the servers: the disks of each server are
+ * spread over its connections round-robin. jbod_conn_submit_block then
+ * wants the disk number on that server, |disk_num| % JBOD_NUM_DISKS. */
+jbod_conn_t *jbod_route(int disk_num);
+
+/* Returns 0 on success and -1 on failure. jbod_conn_flush on every
+ * connection of the pool, sending on all of them before waiting on any,
+ * so the servers work on their batches at the same time. */
+int jbod_pool_flush(void);
+
 #endif
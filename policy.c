@@ -0,0 +1,360 @@
+#include "policy.h"
+#include <stdbool.h>
+#include <stdlib.h>
+
+// the lists a policy keeps its entries on, most recently used first. LRU uses T1 only; 2Q keeps A1in in T1, Am in
+// T2 and the A1out ghosts in B1; ARC uses all four under their own names; CLOCK uses none.
+enum { LIST_NONE = -1, LIST_T1, LIST_T2, LIST_B1, LIST_B2, NUM_LISTS };
+
+// a resident entry (index below capacity) or a ghost that only remembers the key of an evicted entry
+typedef struct {
+    uint32_t key;
+    int list;
+    int prev;
+    int next;
+    int hash_next; // next ghost in the same bucket, or the next free ghost
+    bool ref;      // CLOCK reference bit
+    bool pinned;   // the entry may not be evicted
+} node_t;
+
+typedef struct {
+    int head;
+    int tail;
+    int size;
+} list_t;
+
+struct policy {
+    cache_policy_t kind;
+    int capacity;
+    node_t *nodes; // capacity resident nodes followed by capacity + 1 ghost nodes
+    list_t lists[NUM_LISTS];
+
+    // ghosts are found by key through their own hash table
+    int *buckets;
+    int num_buckets;
+    int free_ghost;
+
+    // the ghost list policy_evict should remember the victim on, as decided by policy_victim
+    int victim_ghost_list;
+
+    int hand;   // CLOCK hand
+    int target; // ARC target size of T1 (p in the paper)
+    int kin;    // 2Q bound on A1in
+    int kout;   // 2Q bound on A1out
+};
+
+static void list_remove(policy_t *pol, int n) {
+    node_t *node = &pol->nodes[n];
+    list_t *l = &pol->lists[node->list];
+
+    if (node->prev != -1) {
+        pol->nodes[node->prev].next = node->next;
+    } else {
+        l->head = node->next;
+    }
+    if (node->next != -1) {
+        pol->nodes[node->next].prev = node->prev;
+    } else {
+        l->tail = node->prev;
+    }
+    l->size--;
+    node->list = LIST_NONE;
+}
+
+static void list_push_front(policy_t *pol, int list, int n) {
+    node_t *node = &pol->nodes[n];
+    list_t *l = &pol->lists[list];
+
+    node->list = list;
+    node->prev = -1;
+    node->next = l->head;
+    if (l->head != -1) {
+        pol->nodes[l->head].prev = n;
+    }
+    l->head = n;
+    if (l->tail == -1) {
+        l->tail = n;
+    }
+    l->size++;
+}
+
+static int bucket_of(const policy_t *pol, uint32_t key) { return (int)((key * 2654435761u) >> 7) & (pol->num_buckets - 1); }
+
+// returns the ghost node remembering key, or -1
+static int ghost_find(const policy_t *pol, uint32_t key) {
+    for (int n = pol->buckets[bucket_of(pol, key)]; n != -1; n = pol->nodes[n].hash_next) {
+        if (pol->nodes[n].key == key) {
+            return n;
+        }
+    }
+    return -1;
+}
+
+// forgets the ghost node n and returns it to the free list
+static void ghost_drop(policy_t *pol, int n) {
+    int *p = &pol->buckets[bucket_of(pol, pol->nodes[n].key)];
+    while (*p != n) {
+        p = &pol->nodes[*p].hash_next;
+    }
+    *p = pol->nodes[n].hash_next;
+
+    list_remove(pol, n);
+    pol->nodes[n].hash_next = pol->free_ghost;
+    pol->free_ghost = n;
+}
+
+// remembers key at the front of the given ghost list, dropping the oldest ghost of the longer list if none is free
+static void ghost_add(policy_t *pol, int list, uint32_t key) {
+    if (pol->free_ghost == -1) {
+        int longer = pol->lists[LIST_B1].size >= pol->lists[LIST_B2].size ? LIST_B1 : LIST_B2;
+        ghost_drop(pol, pol->lists[longer].tail);
+    }
+
+    int n = pol->free_ghost;
+    pol->free_ghost = pol->nodes[n].hash_next;
+    pol->nodes[n].key = key;
+    pol->nodes[n].hash_next = pol->buckets[bucket_of(pol, key)];
+    pol->buckets[bucket_of(pol, key)] = n;
+    list_push_front(pol, list, n);
+}
+
+policy_t *policy_create(cache_policy_t kind, int capacity) {
+    if (kind < 0 || kind >= CACHE_NUM_POLICIES || capacity < 1) {
+        return NULL;
+    }
+
+    policy_t *pol = calloc(1, sizeof(policy_t));
+    if (pol == NULL) {
+        return NULL;
+    }
+
+    pol->num_buckets = 1;
+    while (pol->num_buckets < 2 * capacity) {
+        pol->num_buckets <<= 1;
+    }
+    // ARC keeps up to capacity ghosts and briefly one more while a ghost hit is being turned back into an entry
+    pol->nodes = calloc(2 * capacity + 1, sizeof(node_t));
+    pol->buckets = malloc(pol->num_buckets * sizeof(int));
+    if (pol->nodes == NULL || pol->buckets == NULL) {
+        policy_destroy(pol);
+        return NULL;
+    }
+
+    pol->kind = kind;
+    pol->capacity = capacity;
+    for (int i = 0; i < NUM_LISTS; i++) {
+        pol->lists[i].head = -1;
+        pol->lists[i].tail = -1;
+        pol->lists[i].size = 0;
+    }
+    for (int i = 0; i < pol->num_buckets; i++) {
+        pol->buckets[i] = -1;
+    }
+
+    // resident nodes start off every list; ghost nodes start on the free list
+    for (int i = 0; i < 2 * capacity + 1; i++) {
+        pol->nodes[i].list = LIST_NONE;
+        pol->nodes[i].hash_next = (i >= capacity && i < 2 * capacity) ? i + 1 : -1;
+    }
+    pol->free_ghost = capacity;
+    pol->victim_ghost_list = LIST_NONE;
+
+    // 2Q parameters as recommended by Johnson and Shasha: A1in holds a quarter of the cache, A1out half of it
+    pol->kin = capacity / 4 > 0 ? capacity / 4 : 1;
+    pol->kout = capacity / 2 > 0 ? capacity / 2 : 1;
+    return pol;
+}
+
+void policy_destroy(policy_t *pol) {
+    if (pol != NULL) {
+        free(pol->nodes);
+        free(pol->buckets);
+        free(pol);
+    }
+}
+
+void policy_insert(policy_t *pol, int slot, uint32_t key) {
+    int ghost;
+
+    pol->nodes[slot].key = key;
+    pol->nodes[slot].ref = true;
+
+    switch (pol->kind) {
+    case CACHE_POLICY_LRU:
+        list_push_front(pol, LIST_T1, slot);
+        break;
+
+    case CACHE_POLICY_CLOCK:
+        break;
+
+    // a block seen again while its ghost is on A1out has proven itself and goes to Am; anything else starts on A1in
+    case CACHE_POLICY_2Q:
+    case CACHE_POLICY_ARC:
+        ghost = ghost_find(pol, key);
+        if (ghost != -1) {
+            ghost_drop(pol, ghost);
+            list_push_front(pol, LIST_T2, slot);
+        } else {
+            list_push_front(pol, LIST_T1, slot);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+void policy_hit(policy_t *pol, int slot) {
+    node_t *node = &pol->nodes[slot];
+
+    switch (pol->kind) {
+    case CACHE_POLICY_LRU:
+        list_remove(pol, slot);
+        list_push_front(pol, LIST_T1, slot);
+        break;
+
+    case CACHE_POLICY_CLOCK:
+        node->ref = true;
+        break;
+
+    // hits on A1in do not count: a correlated burst of references should not promote a block
+    case CACHE_POLICY_2Q:
+        if (node->list == LIST_T2) {
+            list_remove(pol, slot);
+            list_push_front(pol, LIST_T2, slot);
+        }
+        break;
+
+    case CACHE_POLICY_ARC:
+        list_remove(pol, slot);
+        list_push_front(pol, LIST_T2, slot);
+        break;
+
+    default:
+        break;
+    }
+}
+
+void policy_pin(policy_t *pol, int slot, bool pinned) { pol->nodes[slot].pinned = pinned; }
+
+// the least recently used entry on list that is not pinned, or -1 if there is none
+static int last_unpinned(const policy_t *pol, int list) {
+    int n = pol->lists[list].tail;
+
+    while (n != -1 && pol->nodes[n].pinned) {
+        n = pol->nodes[n].prev;
+    }
+    return n;
+}
+
+// picks the victim from list, or from other if everything on list is pinned, and has it remembered on the ghost list
+// that goes with the list it came from
+static int pick_victim(policy_t *pol, int list, int ghost_list, int other, int other_ghost_list) {
+    int victim = last_unpinned(pol, list);
+
+    pol->victim_ghost_list = ghost_list;
+    if (victim == -1) {
+        victim = last_unpinned(pol, other);
+        pol->victim_ghost_list = victim == -1 ? LIST_NONE : other_ghost_list;
+    }
+    return victim;
+}
+
+// ARC's REPLACE step: evict from T1 while it is above its target, otherwise from T2
+static int arc_replace(policy_t *pol, bool in_b2) {
+    int t1 = pol->lists[LIST_T1].size;
+
+    if (t1 >= 1 && ((in_b2 && t1 == pol->target) || t1 > pol->target || pol->lists[LIST_T2].size == 0)) {
+        return pick_victim(pol, LIST_T1, LIST_B1, LIST_T2, LIST_B2);
+    }
+    return pick_victim(pol, LIST_T2, LIST_B2, LIST_T1, LIST_B1);
+}
+
+static int arc_victim(policy_t *pol, uint32_t key) {
+    int c = pol->capacity;
+    int b1 = pol->lists[LIST_B1].size;
+    int b2 = pol->lists[LIST_B2].size;
+    int ghost = ghost_find(pol, key);
+
+    // a ghost hit on B1 says T1 was too small, one on B2 that T2 was; move the target accordingly
+    if (ghost != -1 && pol->nodes[ghost].list == LIST_B1) {
+        pol->target += (b2 / b1 > 1) ? b2 / b1 : 1;
+        if (pol->target > c) {
+            pol->target = c;
+        }
+        return arc_replace(pol, false);
+    }
+    if (ghost != -1) {
+        pol->target -= (b1 / b2 > 1) ? b1 / b2 : 1;
+        if (pol->target < 0) {
+            pol->target = 0;
+        }
+        return arc_replace(pol, true);
+    }
+
+    // a new block: keep T1 + B1 and the whole directory within their bounds
+    if (pol->lists[LIST_T1].size + b1 >= c) {
+        if (pol->lists[LIST_T1].size < c) {
+            ghost_drop(pol, pol->lists[LIST_B1].tail);
+            return arc_replace(pol, false);
+        }
+        return pick_victim(pol, LIST_T1, LIST_NONE, LIST_T2, LIST_NONE);
+    }
+    if (pol->lists[LIST_T1].size + pol->lists[LIST_T2].size + b1 + b2 >= 2 * c && b2 > 0) {
+        ghost_drop(pol, pol->lists[LIST_B2].tail);
+    }
+    return arc_replace(pol, false);
+}
+
+int policy_victim(policy_t *pol, uint32_t key) {
+    int victim;
+
+    pol->victim_ghost_list = LIST_NONE;
+
+    switch (pol->kind) {
+    case CACHE_POLICY_CLOCK:
+
+        // sweep the hand, clearing reference bits, until it reaches an entry that was not referenced since the last pass;
+        // two rounds find one unless every entry is pinned
+        for (int i = 0; i < 2 * pol->capacity; i++) {
+            victim = pol->hand;
+            pol->hand = (pol->hand + 1) % pol->capacity;
+            if (pol->nodes[victim].pinned) {
+                continue;
+            }
+            if (!pol->nodes[victim].ref) {
+                return victim;
+            }
+            pol->nodes[victim].ref = false;
+        }
+        return -1;
+
+    // A1in gives up its oldest entry, remembered on A1out, while it is over its share; otherwise Am's LRU entry goes
+    case CACHE_POLICY_2Q:
+        if (pol->lists[LIST_T1].size > pol->kin || pol->lists[LIST_T2].size == 0) {
+            return pick_victim(pol, LIST_T1, LIST_B1, LIST_T2, LIST_NONE);
+        }
+        return pick_victim(pol, LIST_T2, LIST_NONE, LIST_T1, LIST_B1);
+
+    case CACHE_POLICY_ARC:
+        return arc_victim(pol, key);
+
+    default:
+        return last_unpinned(pol, LIST_T1);
+    }
+}
+
+void policy_evict(policy_t *pol, int slot) {
+    if (pol->nodes[slot].list != LIST_NONE) {
+        list_remove(pol, slot);
+    }
+
+    // 2Q bounds A1out itself; ARC's bounds were enforced when the victim was picked
+    if (pol->victim_ghost_list != LIST_NONE) {
+        if (pol->kind == CACHE_POLICY_2Q && pol->lists[LIST_B1].size >= pol->kout) {
+            ghost_drop(pol, pol->lists[LIST_B1].tail);
+        }
+        ghost_add(pol, pol->victim_ghost_list, pol->nodes[slot].key);
+    }
+    pol->victim_ghost_list = LIST_NONE;
+}
@@ -0,0 +1,38 @@
+#ifndef POLICY_H_
+#define POLICY_H_
+
+#include <stdint.h>
+
+#include "cache.h"
+
+/* Replacement state of a cache whose entries live in slots 0 to capacity - 1.
+ * The cache names blocks by a key and tells the policy about every insert,
+ * hit and eviction; the policy decides which slot to evict next. */
+typedef struct policy policy_t;
+
+/* Returns the new policy state, or NULL if |kind| is unknown or allocation
+ * fails. */
+policy_t *policy_create(cache_policy_t kind, int capacity);
+
+/* Frees the policy state. */
+void policy_destroy(policy_t *policy);
+
+/* The entry in |slot| was just filled with the block named |key|. */
+void policy_insert(policy_t *policy, int slot, uint32_t key);
+
+/* The entry in |slot| was accessed. */
+void policy_hit(policy_t *policy, int slot);
+
+/* The entry in |slot| may not be evicted while |pinned| is true. */
+void policy_pin(policy_t *policy, int slot, bool pinned);
+
+/* Returns the slot to evict to make room for the block named |key|, or -1
+ * if every entry is pinned. Only called while every slot is in use; a slot
+ * it returns must be passed to policy_evict before the next call, unless
+ * it is pinned instead, after which the next call picks anew. */
+int policy_victim(policy_t *policy, uint32_t key);
+
+/* The entry in |slot| is being evicted. */
+void policy_evict(policy_t *policy, int slot);
+
+#endif
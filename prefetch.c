@@ -0,0 +1,136 @@
+#include "prefetch.h"
+#include "cache.h"
+#include "net.h"
+#include <pthread.h>
+#include <stdio.h>
+
+// the sequential stream seen on one disk
+typedef struct {
+    int next_block;   // block a sequential read would start at, -1 if there is no stream
+    int issued_until; // last block read ahead so far
+    int window;       // how many blocks to keep read ahead of the stream
+} stream_t;
+
+static stream_t streams[JBOD_MAX_DISKS];
+static bool enabled = false;
+
+// the blocks of a stripe unit, after which the next blocks of a disk are far off in linear order, and whether the
+// end of one disk is followed by the start of the next
+static int stripe_blocks = JBOD_NUM_BLOCKS_PER_DISK;
+static bool disks_follow = true;
+
+static int num_issued = 0;
+static int num_used = 0;
+static int num_wasted = 0;
+
+// guards the streams and the counters: the workers plan the read-ahead of their disks concurrently, and a stream may
+// carry over from the disk of one worker to that of the next
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+// told by the cache what became of a read-ahead block: a use widens the window of its disk, a waste halves it
+static void block_outcome(int disk_num, int block_num, bool used) {
+    stream_t *s = &streams[disk_num];
+
+    pthread_mutex_lock(&lock);
+    if (used) {
+        num_used++;
+        if (s->window < PREFETCH_MAX_WINDOW) {
+            s->window++;
+        }
+    } else {
+        num_wasted++;
+        s->window /= 2;
+        if (s->window < PREFETCH_MIN_WINDOW) {
+            s->window = PREFETCH_MIN_WINDOW;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void prefetch_set_enabled(bool enable) {
+    enabled = enable;
+    cache_set_prefetch_hook(enable ? block_outcome : NULL);
+    prefetch_reset();
+}
+
+bool prefetch_enabled(void) { return enabled && cache_enabled(); }
+
+void prefetch_set_layout(mdadm_layout_t layout, int blocks) {
+    pthread_mutex_lock(&lock);
+    stripe_blocks = blocks;
+    disks_follow = layout == MDADM_LAYOUT_LINEAR;
+    pthread_mutex_unlock(&lock);
+}
+
+void prefetch_reset(void) {
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < JBOD_MAX_DISKS; i++) {
+        streams[i].next_block = -1;
+        streams[i].issued_until = -1;
+        streams[i].window = PREFETCH_MIN_WINDOW;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+// prefetch_plan with the lock held; without plan it only records the request
+static int plan_locked(int disk_num, int first_block, int last_block, bool plan, int *ahead_block) {
+    stream_t *s = &streams[disk_num];
+
+    // a request within the block the stream has reached neither moves it on nor breaks it off, as a block touched
+    // again and again would otherwise pass for a stream
+    if (s->next_block != -1 && first_block == s->next_block - 1 && last_block == first_block) {
+        return 0;
+    }
+
+    // an unaligned stream starts each request in the block where the previous one ended
+    bool sequential = (s->next_block != -1) && (first_block == s->next_block || first_block == s->next_block - 1);
+
+    // in a linear layout, a stream that ran off the end of the previous disk carries on at block 0 of this one
+    if (!sequential && disks_follow && first_block == 0 && disk_num > 0 && streams[disk_num - 1].next_block == JBOD_NUM_BLOCKS_PER_DISK) {
+        sequential = true;
+        s->window = streams[disk_num - 1].window;
+        s->issued_until = -1;
+    }
+
+    s->next_block = last_block + 1;
+    if (!sequential || !plan) {
+        s->issued_until = sequential && s->issued_until > last_block ? s->issued_until : last_block;
+        return 0;
+    }
+
+    // refill in bursts: only once the stream has eaten into the second half of what was read ahead
+    if (s->issued_until - last_block > s->window / 2) {
+        return 0;
+    }
+
+    int first = s->issued_until > last_block ? s->issued_until + 1 : last_block + 1;
+    // no further than the end of the stripe unit, past which the disk holds blocks a whole stripe further on
+    int last = last_block + s->window;
+    int unit_end = (last_block / stripe_blocks + 1) * stripe_blocks - 1;
+    if (last > unit_end) {
+        last = unit_end;
+    }
+    if (first > last) {
+        return 0;
+    }
+
+    s->issued_until = last;
+    *ahead_block = first;
+    num_issued += last - first + 1;
+    return last - first + 1;
+}
+
+int prefetch_plan(int disk_num, int first_block, int last_block, int *ahead_block) {
+    pthread_mutex_lock(&lock);
+    int count = plan_locked(disk_num, first_block, last_block, true, ahead_block);
+    pthread_mutex_unlock(&lock);
+    return count;
+}
+
+void prefetch_record(int disk_num, int first_block, int last_block) {
+    pthread_mutex_lock(&lock);
+    plan_locked(disk_num, first_block, last_block, false, NULL);
+    pthread_mutex_unlock(&lock);
+}
+
+void prefetch_print_stats(void) { fprintf(stderr, "Read-ahead: %d blocks, %d used, %d wasted\n", num_issued, num_used, num_wasted); }
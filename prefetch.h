@@ -0,0 +1,46 @@
+#ifndef PREFETCH_H_
+#define PREFETCH_H_
+
+#include <stdbool.h>
+
+#include "jbod.h"
+#include "mdadm.h"
+
+/* Bounds of the per-disk read-ahead window, in blocks. */
+#define PREFETCH_MIN_WINDOW 2
+#define PREFETCH_MAX_WINDOW 32
+
+/* Turns read-ahead on or off. While it is on, the cache reports back which
+ * read-ahead blocks were used and which were evicted unused, and the window
+ * of each disk adapts to that. */
+void prefetch_set_enabled(bool enable);
+
+/* Returns true if read-ahead is enabled and false if not. */
+bool prefetch_enabled(void);
+
+/* Tells read-ahead how the linear address space is laid out over the disks,
+ * so that it only reads ahead the blocks that come next in linear order:
+ * up to the end of a stripe unit of |stripe_blocks| blocks, and on to the
+ * next disk only for a linear layout. */
+void prefetch_set_layout(mdadm_layout_t layout, int stripe_blocks);
+
+/* Forgets every stream, e.g. after the disks were remounted. */
+void prefetch_reset(void);
+
+/* Records a demand read or write of blocks |first_block| to |last_block|
+ * of |disk_num| and returns how many blocks should be read ahead, starting
+ * at the block stored in |ahead_block|. Returns 0 unless the request
+ * continues a sequential stream whose read-ahead has run low; reads and
+ * writes make up one stream. */
+int prefetch_plan(int disk_num, int first_block, int last_block, int *ahead_block);
+
+/* Records a request like prefetch_plan without reading anything ahead of
+ * it, e.g. a write that replaces all of its blocks, which carries its
+ * stream on but would not read the blocks after it either. */
+void prefetch_record(int disk_num, int first_block, int last_block);
+
+/* Prints how many blocks were read ahead and how many of them were used or
+ * evicted unused. */
+void prefetch_print_stats(void);
+
+#endif
@@ -0,0 +1,188 @@
+#include "stats.h"
+#include <stdatomic.h>
+#include <time.h>
+
+// a histogram being recorded into; the smallest value is kept plus one so that zero can mean nothing was recorded
+typedef struct {
+    atomic_ulong count;
+    atomic_ulong sum_ns;
+    atomic_ulong min_ns_plus_one;
+    atomic_ulong max_ns;
+    atomic_ulong buckets[STATS_NUM_BUCKETS];
+} histogram_t;
+
+static atomic_ulong counters[STATS_NUM_COUNTERS];
+static atomic_ulong jbod_ops[JBOD_NUM_CMDS];
+static histogram_t histograms[STATS_NUM_HISTOGRAMS];
+
+// the names the counters, commands and histograms go by in the JSON dump
+static const char *counter_names[STATS_NUM_COUNTERS] = {
+    "jbod_failures", "bytes_sent", "bytes_received", "cache_hits", "cache_misses", "cache_inserts", "cache_evictions",
+    "cache_writebacks", "reads", "writes", "read_bytes", "write_bytes", "io_failures", "mirror_reads",
+    "l2_hits", "l2_inserts"};
+static const char *command_names[JBOD_NUM_CMDS] = {"mount", "unmount", "seek_to_disk", "seek_to_block", "read_block", "write_block", "sign_block"};
+static const char *histogram_names[STATS_NUM_HISTOGRAMS] = {"jbod_latency_ns", "read_latency_ns", "write_latency_ns"};
+
+// the bucket a value falls into: values below two octaves' worth of sub-buckets get one each, larger ones share a
+// bucket with the values that agree with them in their leading STATS_SUB_BUCKET_BITS + 1 bits
+static int bucket_of(uint64_t ns) {
+    if (ns < (2u << STATS_SUB_BUCKET_BITS)) {
+        return (int)ns;
+    }
+    int exponent = 63 - __builtin_clzll(ns);
+    return ((exponent - STATS_SUB_BUCKET_BITS) << STATS_SUB_BUCKET_BITS) + (int)(ns >> (exponent - STATS_SUB_BUCKET_BITS));
+}
+
+// the smallest value that falls into bucket i
+static uint64_t bucket_low(int i) {
+    if (i < (2 << STATS_SUB_BUCKET_BITS)) {
+        return i;
+    }
+    int exponent = (i >> STATS_SUB_BUCKET_BITS) + STATS_SUB_BUCKET_BITS - 1;
+    uint64_t mantissa = (i & ((1 << STATS_SUB_BUCKET_BITS) - 1)) | (1 << STATS_SUB_BUCKET_BITS);
+    return mantissa << (exponent - STATS_SUB_BUCKET_BITS);
+}
+
+// the largest value that falls into bucket i
+static uint64_t bucket_high(int i) { return i + 1 < STATS_NUM_BUCKETS ? bucket_low(i + 1) - 1 : UINT64_MAX; }
+
+void stats_add(stats_counter_t counter, uint64_t n) { atomic_fetch_add_explicit(&counters[counter], n, memory_order_relaxed); }
+
+void stats_count_command(int cmd) {
+    if (cmd >= 0 && cmd < JBOD_NUM_CMDS) {
+        atomic_fetch_add_explicit(&jbod_ops[cmd], 1, memory_order_relaxed);
+    }
+}
+
+uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+void stats_record(stats_histogram_id_t id, uint64_t ns) {
+    histogram_t *h = &histograms[id];
+
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum_ns, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->buckets[bucket_of(ns)], 1, memory_order_relaxed);
+
+    // the extremes only move in one direction, so retrying until nobody got in between settles them
+    unsigned long min = atomic_load_explicit(&h->min_ns_plus_one, memory_order_relaxed);
+    while ((min == 0 || ns + 1 < min) && !atomic_compare_exchange_weak(&h->min_ns_plus_one, &min, ns + 1)) {
+    }
+    unsigned long max = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+    while (ns > max && !atomic_compare_exchange_weak(&h->max_ns, &max, ns)) {
+    }
+}
+
+void stats_get(stats_t *stats) {
+    for (int i = 0; i < STATS_NUM_COUNTERS; i++) {
+        stats->counters[i] = counters[i];
+    }
+    for (int i = 0; i < JBOD_NUM_CMDS; i++) {
+        stats->jbod_ops[i] = jbod_ops[i];
+    }
+    for (int i = 0; i < STATS_NUM_HISTOGRAMS; i++) {
+        stats_histogram_t *out = &stats->histograms[i];
+        histogram_t *h = &histograms[i];
+
+        out->count = h->count;
+        out->sum_ns = h->sum_ns;
+        out->min_ns = h->min_ns_plus_one == 0 ? 0 : h->min_ns_plus_one - 1;
+        out->max_ns = h->max_ns;
+        for (int b = 0; b < STATS_NUM_BUCKETS; b++) {
+            out->buckets[b] = h->buckets[b];
+        }
+    }
+}
+
+void stats_reset(void) {
+    for (int i = 0; i < STATS_NUM_COUNTERS; i++) {
+        counters[i] = 0;
+    }
+    for (int i = 0; i < JBOD_NUM_CMDS; i++) {
+        jbod_ops[i] = 0;
+    }
+    for (int i = 0; i < STATS_NUM_HISTOGRAMS; i++) {
+        histogram_t *h = &histograms[i];
+
+        h->count = 0;
+        h->sum_ns = 0;
+        h->min_ns_plus_one = 0;
+        h->max_ns = 0;
+        for (int b = 0; b < STATS_NUM_BUCKETS; b++) {
+            h->buckets[b] = 0;
+        }
+    }
+}
+
+uint64_t stats_percentile(const stats_histogram_t *h, double percentile) {
+    uint64_t seen = 0;
+
+    if (h->count == 0) {
+        return 0;
+    }
+
+    // the rank of the value asked for, counting from one
+    uint64_t rank = (uint64_t)(percentile / 100 * h->count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+    if (rank > h->count) {
+        rank = h->count;
+    }
+    for (int b = 0; b < STATS_NUM_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank) {
+            return bucket_high(b) < h->max_ns ? bucket_high(b) : h->max_ns;
+        }
+    }
+    return h->max_ns;
+}
+
+// writes a histogram as a JSON object with its summary, percentiles and non-empty buckets as [low, high, count]
+static void dump_histogram(FILE *out, const stats_histogram_t *h) {
+    static const double percentiles[] = {50, 90, 99, 99.9};
+    static const char *percentile_names[] = {"p50", "p90", "p99", "p999"};
+    const char *sep = "";
+
+    fprintf(out, "{\"count\": %lu, \"min\": %lu, \"mean\": %lu, \"max\": %lu", (unsigned long)h->count, (unsigned long)h->min_ns,
+            (unsigned long)(h->count == 0 ? 0 : h->sum_ns / h->count), (unsigned long)h->max_ns);
+    for (int i = 0; i < (int)(sizeof(percentiles) / sizeof(percentiles[0])); i++) {
+        fprintf(out, ", \"%s\": %lu", percentile_names[i], (unsigned long)stats_percentile(h, percentiles[i]));
+    }
+    fprintf(out, ", \"buckets\": [");
+    for (int b = 0; b < STATS_NUM_BUCKETS; b++) {
+        if (h->buckets[b] != 0) {
+            fprintf(out, "%s[%lu, %lu, %lu]", sep, (unsigned long)bucket_low(b), (unsigned long)bucket_high(b), (unsigned long)h->buckets[b]);
+            sep = ", ";
+        }
+    }
+    fprintf(out, "]}");
+}
+
+int stats_dump_json(FILE *out) {
+    stats_t stats;
+
+    if (out == NULL) {
+        return -1;
+    }
+    stats_get(&stats);
+
+    fprintf(out, "{\n  \"counters\": {");
+    for (int i = 0; i < STATS_NUM_COUNTERS; i++) {
+        fprintf(out, "%s\"%s\": %lu", i == 0 ? "" : ", ", counter_names[i], (unsigned long)stats.counters[i]);
+    }
+    fprintf(out, "},\n  \"jbod_ops\": {");
+    for (int i = 0; i < JBOD_NUM_CMDS; i++) {
+        fprintf(out, "%s\"%s\": %lu", i == 0 ? "" : ", ", command_names[i], (unsigned long)stats.jbod_ops[i]);
+    }
+    fprintf(out, "},\n  \"histograms\": {");
+    for (int i = 0; i < STATS_NUM_HISTOGRAMS; i++) {
+        fprintf(out, "%s\n    \"%s\": ", i == 0 ? "" : ",", histogram_names[i]);
+        dump_histogram(out, &stats.histograms[i]);
+    }
+    fprintf(out, "\n  }\n}\n");
+    return ferror(out) ? -1 : 0;
+}
@@ -0,0 +1,89 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "jbod.h"
+
+/* Latency histograms keep HDR-style log-linear buckets: every power of two
+ * is split into 1 << STATS_SUB_BUCKET_BITS buckets of equal width, so a
+ * recorded value is off by at most 1/16th whatever its magnitude. */
+#define STATS_SUB_BUCKET_BITS 4
+#define STATS_NUM_BUCKETS ((64 - STATS_SUB_BUCKET_BITS + 1) << STATS_SUB_BUCKET_BITS)
+
+/* Counters kept by the mdadm, net and cache modules. */
+typedef enum {
+  STATS_JBOD_FAILURES,   /* JBOD operations answered with an error */
+  STATS_BYTES_SENT,      /* block bytes sent to the server */
+  STATS_BYTES_RECEIVED,  /* block bytes received from the server */
+  STATS_CACHE_HITS,
+  STATS_CACHE_MISSES,
+  STATS_CACHE_INSERTS,
+  STATS_CACHE_EVICTIONS,
+  STATS_CACHE_WRITEBACKS, /* dirty blocks handed back to the disks */
+  STATS_READS,            /* mdadm read requests that succeeded */
+  STATS_WRITES,
+  STATS_READ_BYTES,
+  STATS_WRITE_BYTES,
+  STATS_IO_FAILURES,      /* mdadm requests that failed */
+  STATS_MIRROR_READS,     /* block reads sent to the second copy of a mirror */
+  STATS_L2_HITS,          /* cache misses found in the second level */
+  STATS_L2_INSERTS,       /* blocks evicted into the second level */
+  STATS_NUM_COUNTERS,
+} stats_counter_t;
+
+/* Latencies kept in histograms, in nanoseconds. */
+typedef enum {
+  STATS_JBOD_LATENCY,  /* a JBOD operation, from being queued to its answer */
+  STATS_READ_LATENCY,  /* an mdadm read request, from its start to its end */
+  STATS_WRITE_LATENCY,
+  STATS_NUM_HISTOGRAMS,
+} stats_histogram_id_t;
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum_ns;
+  uint64_t min_ns;
+  uint64_t max_ns;
+  uint64_t buckets[STATS_NUM_BUCKETS];
+} stats_histogram_t;
+
+/* A snapshot of everything that was counted since the start or the last
+ * stats_reset. */
+typedef struct {
+  uint64_t counters[STATS_NUM_COUNTERS];
+  uint64_t jbod_ops[JBOD_NUM_CMDS]; /* JBOD operations queued, by command */
+  stats_histogram_t histograms[STATS_NUM_HISTOGRAMS];
+} stats_t;
+
+/* Adds |n| to |counter|. Safe to call from any thread, as are the other
+ * recording functions. */
+void stats_add(stats_counter_t counter, uint64_t n);
+
+/* Counts a JBOD operation with command |cmd|. */
+void stats_count_command(int cmd);
+
+/* Returns a monotonic timestamp in nanoseconds to measure latencies with. */
+uint64_t stats_now(void);
+
+/* Records a latency of |ns| nanoseconds in |histogram|. */
+void stats_record(stats_histogram_id_t histogram, uint64_t ns);
+
+/* Copies the current counters and histograms into |stats|. */
+void stats_get(stats_t *stats);
+
+/* Sets every counter and histogram back to zero. */
+void stats_reset(void);
+
+/* Returns the latency at or below which |percentile| (0 to 100) of the
+ * values recorded in |histogram| fall, as the upper end of their bucket,
+ * or 0 if nothing was recorded. */
+uint64_t stats_percentile(const stats_histogram_t *histogram, double percentile);
+
+/* Returns 0 on success and -1 on failure. Writes the current counters and
+ * histograms to |out| as a JSON object; each histogram comes with its
+ * percentiles and its non-empty buckets. */
+int stats_dump_json(FILE *out);
+
+#endif
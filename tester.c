@@ -16,17 +16,68 @@
 #include "mdadm.h"
 #include "util.h"
 #include "tester.h"
+#include "l2cache.h"
 #include "net.h"
-
-#define TESTER_ARGUMENTS "hw:s:"
-#define USAGE                                               \
-  "USAGE: test [-h] [-w workload-file] [-s cache_size] \n"  \
-  "\n"                                                      \
-  "where:\n"                                                \
-  "    -h - help mode (display this message)\n"             \
-  "\n"                                                      \
-
-int run_workload(char *workload, int cache_size);
+#include "prefetch.h"
+#include "stats.h"
+#include "workload.h"
+
+#define TESTER_ARGUMENTS "hbrtlMc:e:j:w:s:p:u:P:G:L:F:T:"
+#define USAGE                                                                     \
+  "USAGE: test [-h] [-b] [-r] [-t] [-l] [-c num_conns] [-w workload-file]\n"      \
+  "            [-e servers] [-s cache_size] [-p policy] [-j stats-file]\n"        \
+  "            [-u stripe_unit] [-M] [-P snapshot-file] [-G generation]\n"        \
+  "            [-L l2_size] [-F l2-file] [-T timeout_ms]\n"                       \
+  "\n"                                                                            \
+  "where:\n"                                                                      \
+  "    -h - help mode (display this message)\n"                                   \
+  "    -b - write-back cache (requires -s)\n"                                     \
+  "    -r - sequential read-ahead into the cache (requires -s)\n"                 \
+  "    -p - cache replacement policy: lru (default), clock, 2q or arc\n"          \
+  "    -t - one I/O worker and server connection per disk (needs a server\n"      \
+  "         that accepts several connections at once)\n"                          \
+  "    -c - number of connections to each server the disks are spread over\n"     \
+  "         (default 1; needs a server that keeps a head position per\n"          \
+  "         connection)\n"                                                       \
+  "    -T - milliseconds a server may take to answer the probe sent over each\n"  \
+  "         new connection, which catches one that never serves it; 0 skips\n"    \
+  "         the probe (default 2000)\n"                                           \
+  "    -e - comma separated ip:port list of the JBOD servers whose disks\n"       \
+  "         make up the device, one after the other (default\n"                   \
+  "         127.0.0.1:3333)\n"                                                    \
+  "    -u - stripe the device over the disks (RAID-0) in units of stripe_unit\n"  \
+  "         bytes, a multiple of the block size that divides the disk size\n"     \
+  "         (default: linear)\n"                                                  \
+  "    -M - mirror the first half of the disks onto the second half (RAID-1)\n"   \
+  "    -L - blocks of a second cache level in a memory-mapped file, which\n"      \
+  "         the blocks evicted from the cache go to (requires -s)\n"              \
+  "    -F - file of the second cache level (default l2cache.img)\n"               \
+  "    -P - save the cache to snapshot-file at unmount and warm it up from\n"     \
+  "         there at the next start (requires -s and -G; the disks of -l do\n"    \
+  "         not outlive the run)\n"                                               \
+  "    -G - generation of the disks the snapshot has to match; use a new one\n"   \
+  "         whenever they may have changed since it was saved, e.g. on every\n"   \
+  "         run against a server that zeroes them at mount\n"                     \
+  "    -l - run JBOD in this process instead of talking to the server\n"          \
+  "    -j - write counters and latency histograms to stats-file as JSON\n"        \
+  "\n"                                                                            \
+
+static bool write_back = false;
+static bool read_ahead = false;
+static bool workers = false;
+static bool local = false;
+static int num_conns = 1;
+static jbod_server_t servers[JBOD_MAX_SERVERS] = {{JBOD_SERVER, JBOD_PORT}};
+static int num_servers = 1;
+static mdadm_layout_t layout = MDADM_LAYOUT_LINEAR;
+static int stripe_unit = 0;
+static char *stats_file = NULL;
+static int l2_size = 0;
+static char *l2_file = L2CACHE_DEFAULT_FILE;
+static char *snapshot = NULL;
+static uint64_t generation = 0;
+static bool generation_given = false;
+static cache_policy_t policy = CACHE_POLICY_LRU;
 
 int main(int argc, char *argv[])
 {
@@ -41,6 +92,63 @@ int main(int argc, char *argv[])
       case 's':
         cache_size = atoi(optarg);
         break;
+      case 'b':
+        write_back = true;
+        break;
+      case 'r':
+        read_ahead = true;
+        break;
+      case 't':
+        workers = true;
+        break;
+      case 'l':
+        local = true;
+        break;
+      case 'c':
+        num_conns = atoi(optarg);
+        break;
+      case 'e':
+        num_servers = jbod_parse_servers(optarg, servers, JBOD_MAX_SERVERS);
+        if (num_servers == -1) {
+          fprintf(stderr, "Bad server list (%s), aborting.\n", optarg);
+          return -1;
+        }
+        break;
+      case 'T':
+        jbod_set_connect_timeout(atoi(optarg));
+        break;
+      case 'j':
+        stats_file = optarg;
+        break;
+      case 'p':
+        for (policy = 0; policy < CACHE_NUM_POLICIES; ++policy)
+          if (strcmp(optarg, cache_policy_name(policy)) == 0)
+            break;
+        if (policy == CACHE_NUM_POLICIES) {
+          fprintf(stderr, "Unknown cache policy (%s), aborting.\n", optarg);
+          return -1;
+        }
+        break;
+      case 'u':
+        layout = MDADM_LAYOUT_STRIPED;
+        stripe_unit = atoi(optarg);
+        break;
+      case 'M':
+        layout = MDADM_LAYOUT_MIRRORED;
+        break;
+      case 'L':
+        l2_size = atoi(optarg);
+        break;
+      case 'F':
+        l2_file = optarg;
+        break;
+      case 'P':
+        snapshot = optarg;
+        break;
+      case 'G':
+        generation = strtoull(optarg, NULL, 10);
+        generation_given = true;
+        break;
       case 'w':
         workload = optarg;
         break;
@@ -50,92 +158,44 @@ int main(int argc, char *argv[])
     }
   }
 
-  if (!workload) {
+  // a snapshot is only as good as the generation that says which disks it is of, and those of -l die with us; the
+  // options of the cache mean nothing without one
+  if (!workload || (local && workers) || (workers && num_servers > 1) || (snapshot && (!generation_given || local)) ||
+      (!cache_size && (write_back || read_ahead || l2_size || snapshot))) {
     fprintf(stderr, USAGE);
     return -1;
   }
 
-  if (!jbod_connect(JBOD_SERVER, JBOD_PORT))
-    return -1;
+  if (!local && !jbod_connect_servers(servers, num_servers, num_conns))
+    errx(1, "Failed to connect to the JBOD servers.");
+  if (workers && mdadm_start_workers(servers[0].ip, servers[0].port) != 1)
+    errx(1, "Failed to start the I/O workers.");
   
-  run_workload(workload, cache_size);
+  workload_options_t options = {
+    .cache_size = cache_size,
+    .policy = policy,
+    .backend = local ? MDADM_BACKEND_LOCAL : MDADM_BACKEND_NETWORK,
+    .layout = layout,
+    .stripe_unit = stripe_unit,
+    .write_back = write_back,
+    .read_ahead = read_ahead,
+    .l2_size = l2_size,
+    .l2_file = l2_file,
+    .snapshot = snapshot,
+    .generation = generation,
+    .signatures = stdout,
+    .report = true,
+  };
+  run_workload(workload, &options);
+  mdadm_stop_workers();
   jbod_disconnect();
 
-  return 0;
-}
-
-int equals(const char *s1, const char *s2) {
-  return strncmp(s1, s2, strlen(s2)) == 0;
-}
-
-static uint32_t encode_op(jbod_cmd_t cmd, int disk_num, int block_num) {
-  assert(cmd >= 0 && cmd < JBOD_NUM_CMDS);
-  assert(block_num >= 0 && block_num < JBOD_NUM_BLOCKS_PER_DISK);
-
-  uint32_t op = 0;
-  op |= cmd << 26;
-  op |= disk_num << 22;
-  op |= block_num;
-
-  return op;
-}
-
-int run_workload(char *workload, int cache_size) {
-  char line[256], cmd[32];
-  uint8_t buf[MAX_IO_SIZE];
-  uint32_t addr, len, ch;
-  int rc;
-
-  memset(buf, 0, MAX_IO_SIZE);
-
-  FILE *f = fopen(workload, "r");
-  if (!f)
-    err(1, "Cannot open workload file %s", workload);
-
-  if (cache_size) {
-    rc = cache_create(cache_size);
-    if (rc != 1)
-      errx(1, "Failed to create cache.");
+  if (stats_file) {
+    FILE *f = fopen(stats_file, "w");
+    if (!f || stats_dump_json(f) == -1)
+      err(1, "Cannot write stats file %s", stats_file);
+    fclose(f);
   }
 
-  int line_num = 0;
-  while (fgets(line, 256, f)) {
-    ++line_num;
-    line[strlen(line)-1] = '\0';
-    if (equals(line, "MOUNT")) {
-      rc = mdadm_mount();
-    } else if (equals(line, "UNMOUNT")) {
-      rc = mdadm_unmount();
-    } else if (equals(line, "SIGNALL")) {
-      for (int i = 0; i < JBOD_NUM_DISKS; ++i)
-        for (int j = 0; j < JBOD_NUM_BLOCKS_PER_DISK; ++j) {
-          uint8_t b[JBOD_BLOCK_SIZE];
-          jbod_client_operation(encode_op(JBOD_SIGN_BLOCK, i, j), b);
-          fprintf(stdout, "%s", b);
-        }
-    } else {
-      if (sscanf(line, "%7s %7u %4u %3u", cmd, &addr, &len, &ch) != 4)
-        errx(1, "Failed to parse command: [%s\n], aborting.", line);
-      if (equals(cmd, "READ")) {
-        rc = mdadm_read(addr, len, buf);
-      } else if (equals(cmd, "WRITE")) {
-        memset(buf, ch, len);
-        rc = mdadm_write(addr, len, buf);
-      } else {
-        errx(1, "Unknown command [%s] on line %d, aborting.", line, line_num);
-      }
-    }
-
-    if (rc == -1)
-      errx(1, "tester failed when processing command [%s] on line %d", line, line_num);
-  }
-  fclose(f);
-
-  if (cache_size)
-    cache_destroy();
-
-  jbod_print_cost();
-  cache_print_hit_rate();
-
   return 0;
 }
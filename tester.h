@@ -12,6 +12,6 @@ int jbod_sign_block(int disk_num, int block_num);
 void jbod_initialize_drives_contents();
 void jbod_print_cost(void);
 
-#define MAX_IO_SIZE 1024
+#define MAX_IO_SIZE (JBOD_NUM_DISKS * JBOD_DISK_SIZE)
 
 #endif
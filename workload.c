@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <err.h>
+
+#include "workload.h"
+#include "cache.h"
+#include "jbod.h"
+#include "mdadm.h"
+#include "tester.h"
+#include "prefetch.h"
+
+static int equals(const char *s1, const char *s2) {
+  return strncmp(s1, s2, strlen(s2)) == 0;
+}
+
+/* Runs a "READV addr len ..." or "WRITEV addr len byte ..." line as one
+ * vectored request, the extents laid out one after the other in buf. */
+static int run_vectored(char *line, uint8_t *buf) {
+  mdadm_extent_t extents[MAX_IO_EXTENTS];
+  bool write = equals(line, "WRITEV");
+  uint32_t addr, len, ch, total = 0;
+  int count = 0, used;
+  char *p = line + strlen(write ? "WRITEV" : "READV");
+
+  while (write ? sscanf(p, "%u %u %u%n", &addr, &len, &ch, &used) == 3 : sscanf(p, "%u %u%n", &addr, &len, &used) == 2) {
+    if (count == MAX_IO_EXTENTS || len > MAX_IO_SIZE - total)
+      return -1;
+    extents[count] = (mdadm_extent_t){.addr = addr, .len = len, .buf = buf + total};
+    if (write)
+      memset(buf + total, ch, len);
+    total += len;
+    count++;
+    p += used;
+  }
+  if (count == 0)
+    return -1;
+  return write ? mdadm_writev(extents, count) : mdadm_readv(extents, count);
+}
+
+int run_workload(const char *workload, const workload_options_t *options) {
+  char line[256], cmd[32];
+  static uint8_t buf[MAX_IO_SIZE];
+  uint32_t addr, len, ch;
+  int rc;
+
+  memset(buf, 0, MAX_IO_SIZE);
+
+  FILE *f = fopen(workload, "r");
+  if (!f)
+    err(1, "Cannot open workload file %s", workload);
+
+  if (options->cache_size) {
+    if (cache_set_snapshot(options->snapshot, options->generation) != 1)
+      errx(1, "Failed to set up the cache snapshot.");
+    if (cache_set_l2(options->l2_size ? options->l2_file : NULL, options->l2_size) != 1)
+      errx(1, "Failed to set up the second level of the cache.");
+    rc = cache_create_with_policy(options->cache_size, options->policy);
+    if (rc != 1)
+      errx(1, "Failed to create cache.");
+    if (options->write_back && mdadm_set_write_back(true) != 1)
+      errx(1, "Failed to enable write-back cache.");
+    prefetch_set_enabled(options->read_ahead);
+  }
+
+  int line_num = 0;
+  while (fgets(line, 256, f)) {
+    ++line_num;
+    line[strlen(line)-1] = '\0';
+    if (equals(line, "MOUNT")) {
+      rc = mdadm_set_layout(options->layout, options->stripe_unit);
+      if (rc == 1)
+        rc = mdadm_mount_with_backend(options->backend);
+    } else if (equals(line, "UNMOUNT")) {
+      rc = mdadm_unmount();
+    } else if (equals(line, "SIGNALL")) {
+      if (options->write_back)
+        mdadm_flush();
+      for (int i = 0; options->signatures && i < mdadm_num_disks(); ++i)
+        for (int j = 0; j < JBOD_NUM_BLOCKS_PER_DISK; ++j) {
+          uint8_t b[JBOD_BLOCK_SIZE];
+          mdadm_sign_block(i, j, b);
+          fprintf(options->signatures, "%s", b);
+        }
+    } else if (equals(line, "READV ") || equals(line, "WRITEV ")) {
+      rc = run_vectored(line, buf);
+    } else {
+      if (sscanf(line, "%7s %7u %7u %3u", cmd, &addr, &len, &ch) != 4)
+        errx(1, "Failed to parse command: [%s\n], aborting.", line);
+      if (len > MAX_IO_SIZE) {
+        rc = -1;
+      } else if (equals(cmd, "READ")) {
+        rc = mdadm_read(addr, len, buf);
+      } else if (equals(cmd, "WRITE")) {
+        memset(buf, ch, len);
+        rc = mdadm_write(addr, len, buf);
+      } else {
+        errx(1, "Unknown command [%s] on line %d, aborting.", line, line_num);
+      }
+    }
+
+    // leave the server unmounted for whoever runs next
+    if (rc == -1) {
+      mdadm_unmount();
+      errx(1, "tester failed when processing command [%s] on line %d", line, line_num);
+    }
+  }
+  fclose(f);
+
+  if (options->cache_size && cache_destroy() != 1)
+    errx(1, "Failed to write the dirty blocks of the cache back.");
+
+  if (options->report) {
+    jbod_print_cost();
+    cache_print_hit_rate();
+    mdadm_print_seeks_saved();
+    if (options->read_ahead)
+      prefetch_print_stats();
+  }
+
+  return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef WORKLOAD_H_
+#define WORKLOAD_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "cache.h"
+#include "mdadm.h"
+
+/* How a workload file is replayed. */
+typedef struct {
+  int cache_size;          /* cache entries, or 0 to run without a cache */
+  cache_policy_t policy;
+  mdadm_backend_t backend; /* what MOUNT mounts the disks through */
+  mdadm_layout_t layout;   /* how MOUNT lays the disks out */
+  int stripe_unit;         /* bytes of a stripe unit, for a striped layout */
+  bool write_back;         /* requires a cache */
+  bool read_ahead;         /* requires a cache */
+  int l2_size;             /* blocks of the second level of the cache, or 0
+                            * for none */
+  const char *l2_file;     /* where the second level keeps them */
+  const char *snapshot;    /* where the cache is saved at UNMOUNT and loaded
+                            * from when it is created, or NULL */
+  uint64_t generation;     /* of the disks the snapshot has to match */
+  FILE *signatures;        /* where SIGNALL writes the block signatures; NULL
+                            * only flushes the write-back cache */
+  bool report;             /* print the cost, hit rate and seek counts */
+} workload_options_t;
+
+/* Most extents on a READV or WRITEV line, which keeps it within the 255
+ * characters a line of a workload may have. */
+#define MAX_IO_EXTENTS 8
+
+/* Returns 0 on success and exits on failure. Replays |workload|, a file of
+ * MOUNT, UNMOUNT, SIGNALL, "READ addr len 0" and "WRITE addr len byte" lines,
+ * with a cache set up as |options| says for the time of the replay. A
+ * "READV addr len addr len ..." or "WRITEV addr len byte addr len byte ..."
+ * line is a single mdadm_readv or mdadm_writev over its extents. The
+ * network backend needs a connection to the server. */
+int run_workload(const char *workload, const workload_options_t *options);
+
+#endif